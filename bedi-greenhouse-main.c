@@ -8,12 +8,35 @@ Last Updated: 11/22/2024
 
 /*
 NOTE:
-ENTER USER SETTINGS ON LINES 516-521
+ENTER USER SETTINGS AT THE TOP OF task main()
 */
 
+/*
+MOTOR COMMAND TRACE:
+Uncomment TRACE_MOTOR_COMMANDS to record every motor[] write, multiplexer motor call and
+I2C command frame (time, type, channel, value) to the debug stream and TRACE_FILE.
+Also uncomment TRACE_COMPARE to check each command against GOLDEN_TRACE_FILE instead,
+so changes to the motion code can be verified as behaviour-preserving.
+*/
+//#define TRACE_MOTOR_COMMANDS
+//#define TRACE_COMPARE
+
+/*
+EMERGENCY STOP BENCHMARK:
+Uncomment ESTOP_BENCHMARK to build a test program that, instead of the schedule, runs the phases of
+the first bed and injects an emergency stop at each stall point ESTOP_BENCH_TRIALS times, timing
+every stop from the injected press to the end of the last motor and multiplexer stop write
+(see benchmarkEmergencyStop); the worst case per stall point is shown and written to ESTOP_FILE
+*/
+//#define ESTOP_BENCHMARK
+
+#ifdef TRACE_MOTOR_COMMANDS
+#define __COMMON_H_TRACE__
+#endif
+
 #include "mindsensors‐motormux.h"
 
-//Fail-safe max times (found empirically)
+//Fail-safe max times (found empirically; defaults until a bed is calibrated, see calibrateBed)
 const float MAX_PUMP_TIME = 19500; //axis time + 1 sec
 const float MAX_X_AXIS_TIME = 18500; //measured 16410 runtime
 const float MAX_Y_AXIS_TIME = 10500; //measured 8700 runtime
@@ -22,7 +45,19 @@ const float MAX_ROTATION_TIME = 20000;
 //Rotation constants (found empirically)
 const float ROTATION_DISTANCE = 28;
 const int ROTATION_SPEED = 20;
-const int MAX_ROTATIONS = 2; //change direction after 2 turns
+const int MIN_ORIENTATION = -1; //quarter turns from the start (clockwise positive); the range keeps
+const int MAX_ORIENTATION = 2; //the cable from winding up, as alternating after 2 turns did
+const int ORIENTATION_UNKNOWN = 99; //stopped part way through a turn, until put back at the start
+
+//Light balancing (rotateGreenhouse turns the least lit side of the plant towards the light)
+const long DAY_LENGTH = 86400000; //ms
+const long SUNRISE_TIME = 25200000; //ms after midnight (7:00)
+const long SUNSET_TIME = 68400000; //19:00
+const long EXPOSURE_BALANCE = 3600000; //turn only if the side facing the light has had this much (ms) more light
+
+//Wall clock rules (see tClockRules)
+const int CLOCK_RULE_KINDS = 2; //rules for JOB_WATER and JOB_ROTATE
+const int MAX_CLOCK_TIMES = 4; //times of day per job kind
 
 //Wheel radii and conversion factors (found empirically)
 const float ROTATION_WHEEL_RADIUS = 2.5;
@@ -40,292 +75,3519 @@ const float BUFFER_LENGTH = 3.25; //due to change in direction; 3.5 originally
 const float X_AXIS_SPEED = 5.0;
 const float Y_AXIS_SPEED = 3.0;
 
+//Calibration (hold LEFT while starting to calibrate, see calibrateBed)
+const float X_RAIL_LENGTH = 18.0; //full rails (the axis lengths above are parts of them)
+const float Y_RAIL_LENGTH = 14.0;
+const float CALIBRATION_TIME_MARGIN = 1.2; //fail-safe times: measured time + 20%
+const long PUMP_TIME_MARGIN = 1000; //pump fail-safe: axis time + 1 sec
+const long STALL_TIME = 500; //ms without movement at the end of a rail
+const long STALL_SAMPLE_TIME = 50;
+const int STALL_COUNTS = 2; //encoder counts still treated as no movement
+const long CALIBRATION_MAX_TIME = 60000; //fail-safe per stroke
+const long CALIBRATION_MAGIC = 0x43414C49; //"CALI"
+#define CALIBRATION_FILE "calibration.dat"
+
 //Fail integers (for fail-safe error message)
 const int NO_FAILURE = 0;
 const int ROTATION_FAILED = 1;
 const int PUMP_FAILED = 2;
 const int AXIS_FAILED = 3;
+const int WATCHDOG_FAILED = 4;
+
+//Water level service (filtered tank sensors, see waterLevelService)
+const long TANK_SAMPLE_TIME = 100; //ms between samples
+const int TANK_WINDOW = 7; //samples voted on
+const int TANK_FULL_VOTES = 5; //water samples in the window needed to report water
+const int TANK_EMPTY_VOTES = 2; //at or below this the tank is reported empty (hysteresis)
+
+//Tank gauge (reflected light on the float, hold RIGHT while starting to calibrate)
+const int TANK_GAUGE_POINTS = 4; //calibrated fill heights: 0%, 33%, 67%, 100%
+const int TANK_GAUGE_SAMPLES = 10; //readings averaged per calibration point
+const int TANK_MEDIAN = 5; //readings in the median filter
+const float TANK_FULL_LEVEL = 10; //percent; water is reported above this...
+const float TANK_EMPTY_LEVEL = 5; //...until the level drops to this (hysteresis)
+const long TANK_GAUGE_MAGIC = 0x54414E4B; //"TANK"
+#define TANK_GAUGE_FILE "tankGauge.dat"
+
+//Tank consumption model (see updateTankModel)
+const float PUMP_FLOW_RATE = 1.2; //ml per second of pumping (measure for your pump)
+const float TANK_CAPACITY = 500; //ml, until learned from the tank running dry
+
+//Adaptive watering (see adaptWatering; demand 1 is the configured schedule)
+const float ADAPT_MIN_DEMAND = 0.5;
+const float ADAPT_MAX_DEMAND = 2.0;
+const float ADAPT_MIN_INTERVAL = 0.5; //limits of the water interval, relative to the configured one
+const float ADAPT_MAX_INTERVAL = 2.0;
+const int ADAPT_MIN_PUMP_SPEED = 30; //slower pumps hardly deliver
+const float ADAPT_DAY_DEMAND = 1.2; //without a moisture sensor: more water in daylight...
+const float ADAPT_NIGHT_DEMAND = 0.7; //...less at night
+const float ADAPT_MOISTURE_GAIN = 0.02; //demand per percent of moisture below the target
+const long ADAPT_RESERVE_TIME = 86400000; //tank forecast to run dry within this: stretch the water...
+const float ADAPT_RESERVE_DEMAND = 0.7; //...by this much
+
+//Telemetry (one CSV row per bed every TELEMETRY_INTERVAL, see writeTelemetry)
+const long TELEMETRY_INTERVAL = 600000; //10 minutes
+const long TELEMETRY_FILES = 144; //files kept (a day), the oldest is overwritten
+#define TELEMETRY_FILE "telem%03d.csv" //numbered 0 to TELEMETRY_FILES - 1
+
+//Coverage map (ms pumped over each cell of the bed, see mapCoverage)
+const int COVERAGE_X_CELLS = 8; //cells along the calibrated x travel...
+const int COVERAGE_Y_CELLS = 6; //...and the y travel
+const int COVERAGE_CELLS = 48; //COVERAGE_X_CELLS*COVERAGE_Y_CELLS
+const long COVERAGE_SAMPLE_TIME = 20; //ms between position samples while pumping
+#define COVERAGE_FILE "coverage.csv"
+
+//Watering zones (see waterZones)
+const int MAX_ZONES = 4; //per bed
+const long ZONE_POSITION_TOLERANCE = 5; //encoder counts
 
 //Wait time between messages in milliseconds
 const int WAIT_MESSAGE = 2500; 
 
+//Energy accounting (see accountActuator)
+const float MOTOR_RATED_POWER = 1.5; //W drawn by a motor at full power (estimate)
+
+//Low-power idle between scheduled jobs (see idleWait)
+const long IDLE_DELAY = 30000; //ms without a job or button press before idling
+const long ACTIVE_POLL_TIME = 10; //ms between button checks while awake...
+const long IDLE_POLL_TIME = 250; //...and while idle
+const int BATTERY_EMPTY_LEVEL = 6500; //mV, battery flat
+
+//Watchdog (see watchdogTask): worst-case reaction is WATCHDOG_TIMEOUT + WATCHDOG_PERIOD
+const long WATCHDOG_TIMEOUT = 5000; //ms the main task may go without kicking the watchdog
+const long WATCHDOG_PERIOD = 100; //ms between checks
+#define WATCHDOG_FILE "watchdog.txt"
+
+//Stall points (where the main task last kicked the watchdog, recorded when it trips)
+const int STALL_NONE = 0;
+const int STALL_IDLE = 1; //waiting for the next job
+const int STALL_REFILL = 2; //waiting for water
+const int STALL_WATER = 3; //x axis of a water cycle
+const int STALL_Y_AXIS = 4; //y axis of a water cycle
+const int STALL_RESET = 5; //x axis returning
+const int STALL_ROTATE = 6;
+const int STALL_MESSAGE = 7; //showing a message or stats
+const int STALL_BUTTON = 8; //waiting for a button release
+const int STALL_JOB = 9; //starting a job
+const int STALL_ZONE = 10; //watering a zone, or moving between zones
+const int STALL_POINTS = 11;
+
+//Emergency stop (see emergencyStopTask)
+const long ESTOP_PERIOD = 10; //ms between touch sensor checks (worst-case detection delay)
+const int ESTOP_BENCH_TRIALS = 5; //stops injected per stall point by the benchmark...
+const long ESTOP_BENCH_DELAY = 150; //...the first this long into the phase, each further one this much later
+const long ESTOP_BENCH_PHASE_TIME = 3000; //ms the benchmark idles past the press time (if no stop came)
+#define ESTOP_FILE "estopBench.txt"
+
+//Display model (see showLine)
+const int DISPLAY_LINES = 8; //lines 0-7 are used
+const int DISPLAY_LINE_SIZE = 32; //characters per line, with the terminating 0
+const int DISPLAY_TEXT_SIZE = 64; //buffer lines are formatted in (showLine cuts them to DISPLAY_LINE_SIZE)
+const long DISPLAY_REFRESH_TIME = 100; //ms between screen updates
+
+//Configuration file (replaces the user settings in task main and the time prompt)
+const int MAX_PROFILES = 4;
+const int CONFIG_LINE_SIZE = 100; //longer lines are cut off
+const int CONFIG_NAME_SIZE = 20; //plant and profile names (RobotC string length)
+#define CONFIG_FILE "greenhouse.cfg"
+
+//built-in plant presets (select with plantPreset in task main, or plant <preset name> in CONFIG_FILE)
+const int PRESET_NONE = -1; //user intervals, full dose and coverage
+const int PRESET_SUCCULENT = 0;
+const int PRESET_FERN = 1;
+const int PRESET_HERB = 2;
+const int PRESET_FLOWER = 3;
+const int NUM_PRESETS = 4;
+const float PRESET_WATER_INTERVAL[NUM_PRESETS] = {604800000, 86400000, 172800000, 259200000}; //ms: 7, 1, 2, 3 days
+const int PRESET_PUMP_SPEED[NUM_PRESETS] = {40, 100, 70, 80}; //dose: pump power (flow scales with it)
+const float PRESET_X_SPAN[NUM_PRESETS] = {0.6, 1.0, 1.0, 0.8}; //coverage: fraction of the x travel swept...
+const float PRESET_Y_SPAN[NUM_PRESETS] = {0.5, 1.0, 0.8, 0.8}; //...and of each y pass (from the start corner)
+const float PRESET_ROTATION_INTERVAL[NUM_PRESETS] = {43200000, 21600000, 14400000, 28800000}; //ms: 12, 6, 4, 8 hours
+
+//Checkpoint, so the schedule resumes after a restart
+const long CHECKPOINT_MAGIC = 0x42454432; //"BED2" (changes with the layout, so older files start a new schedule)
+const long CHECKPOINT_INTERVAL = 60000; //save every minute
+const long TIME_RESET_TIMEOUT = 30000; //ms without a button press before a time reset keeps the saved clock
+#define CHECKPOINT_FILE "checkpoint.dat"
+
+//Scheduler (timer wheel on the T1 clock)
+const int MAX_JOBS = 12; //water and rotation for each bed, plus checkpoint and telemetry
+const int WHEEL_SLOTS = 32;
+const long WHEEL_TICK = 1000; //ms per slot
+
+//Job kinds (what dispatchJob runs)
+const int JOB_WATER = 0;
+const int JOB_ROTATE = 1;
+const int JOB_CHECKPOINT = 2;
+const int JOB_TELEMETRY = 3;
+
+//Job priorities (highest due job runs first)
+const int PRIORITY_LOW = 0;
+const int PRIORITY_NORMAL = 1;
+const int PRIORITY_HIGH = 2;
+
+//Beds (one brick drives up to MAX_BEDS greenhouse beds)
+const int MAX_BEDS = 4;
+
+//Rotation PID auto-tuning (hold UP while starting to tune, see tuneRotation)
+const int TUNE_RELAY_POWER = 15; //relay swing either side of the bias power
+const long TUNE_SAMPLE_TIME = 20; //ms between encoder samples
+const long TUNE_SETTLE_TIME = 1000; //ms at ROTATION_SPEED before the speed test
+const int TUNE_CROSSINGS = 14; //relay switches per test
+const int TUNE_SETTLE_CROSSINGS = 4; //first switches ignored (start-up transient)
+const long TUNE_MAX_TIME = 15000; //fail-safe per test
+//MUX register units per power/count: a guess, not measured (the MUX documents no unit for its gains);
+//256 treats the registers as 8.8 fixed point, check the tuned motion before trusting it
+const float PID_GAIN_SCALE = 256;
+const ubyte PID_PASS_COUNT = 5; //encoder count tolerance while moving
+const ubyte PID_TOLERANCE = 2; //encoder count tolerance near the target
+const long PID_MAGIC = 0x50494430; //"PID0"
+#define PID_FILE "rotationPid.dat"
+
+//Motor command trace
+const int TRACE_MOTOR = 0; //motor[] write
+const int TRACE_MUX_MOTOR = 1; //MSMMotor
+const int TRACE_MUX_STOP = 2; //MSMotorStop
+const int TRACE_I2C = 3; //I2C command frame (register*256 + first data byte)
+const long TRACE_TIME_TOLERANCE = 500; //allowed drift from the golden trace (ms)
+#define TRACE_FILE "motorTrace.txt"
+#define GOLDEN_TRACE_FILE "goldenTrace.txt"
+
 /*
-MOTOR A: x direction on 2D axis (1)
-MOTOR B: x direction on 2D axis (2)
-MOTOR C: y direction on 2D axis
-MOTOR D: peristaltic pump
-MULTIPLEXER M1: rotation of greenhouse base
+Low-power idle (see idleWait): while idling every task, the main task included, polls every
+IDLE_POLL_TIME instead of its own period
+idleWakeups counts the polls of all tasks while idle, and idleBusyTime adds up the time from each
+poll's wake-up to its next wait; T1 only counts whole ms, but the wake-ups fall at random points
+within a ms, so the sum averages out to the time the CPU was really awake
 */
+bool idling = false;
+long idleWakeups = 0;
+long idleBusyTime = 0; //ms
 
 /*
-SENSOR 1: multiplexer
-SENSOR 3: touch
-SENSOR 4: colour sensor
+Counts an idle poll that woke at woke and is about to wait again
 */
-void configureSensors()
+void countIdlePoll(long woke)
 {
-	SensorType[S1] = sensorI2CCustom;
-	wait1Msec(50);
-	SensorType[S3] = sensorEV3_Touch;
-	wait1Msec(50);
-	SensorType[S4] = sensorEV3_Color;
-	wait1Msec(50);
-	SensorMode[S4] = modeEV3Color_Color;
-	wait1Msec(50);
+	hogCPU(); //every task counts its polls here
+	idleWakeups++;
+	idleBusyTime += time1[T1] - woke;
+	releaseCPU();
 }
 
-void clearScreen()
+/*
+Waits before a background task's next poll: activePeriod, or IDLE_POLL_TIME while idling
+woke is when the task last woke up, and is set to the new wake-up time
+*/
+void serviceWait(long activePeriod, long& woke)
 {
-	displayTextLine(3, " ");
-	displayTextLine(4, " ");
-	displayTextLine(5, " ");
-	displayTextLine(6, " ");
+	long period = activePeriod;
+	if (idling)
+	{
+		countIdlePoll(woke);
+		period = IDLE_POLL_TIME;
+	}
+	wait1Msec(period);
+	woke = time1[T1];
 }
 
-bool checkFillLevel()
+/*
+Display model: the text wanted on each line is kept here, and displayService pushes only the
+lines that changed to the screen, at most every DISPLAY_REFRESH_TIME
+All screen output goes through showLine (format text with sprintf first)
+*/
+char displayText[DISPLAY_LINES*DISPLAY_LINE_SIZE];
+bool displayDirty[DISPLAY_LINES];
+
+void showLine(int line, const char* text)
 {
-	if (SensorValue[S4] == (int)colorWhite) //no water, ping pong ball at bottom
-		return false;
-	else
-		return true;
+	if (line < 0 || line >= DISPLAY_LINES)
+		return;
+	hogCPU(); //displayService reads the line
+	if (strncmp(&displayText[line*DISPLAY_LINE_SIZE], text, DISPLAY_LINE_SIZE - 1) != 0)
+	{
+		strncpy(&displayText[line*DISPLAY_LINE_SIZE], text, DISPLAY_LINE_SIZE - 1);
+		displayText[line*DISPLAY_LINE_SIZE + DISPLAY_LINE_SIZE - 1] = 0;
+		displayDirty[line] = true;
+	}
+	releaseCPU();
 }
 
-void displayFillLevel()
+task displayService()
 {
-	if (checkFillLevel())
-		displayTextLine(5, "Water available in tank.");
-	else
+	char line[DISPLAY_LINE_SIZE];
+	long woke = time1[T1];
+	while (true)
 	{
-		displayTextLine(4, "Empty water tank.");
-		displayTextLine(5, "Please add water.");
+		for (int i = 0; i < DISPLAY_LINES; i++)
+		{
+			if (displayDirty[i])
+			{
+				hogCPU();
+				strncpy(line, &displayText[i*DISPLAY_LINE_SIZE], DISPLAY_LINE_SIZE);
+				displayDirty[i] = false;
+				releaseCPU();
+				displayTextLine(i, "%s", line);
+			}
+		}
+		serviceWait(DISPLAY_REFRESH_TIME, woke);
 	}
 }
 
-//Starts pump and returns time of start
-float startPump()
+void startDisplay()
 {
-	float startTime = time1[T1];
-	motor[motorD] = PUMP_SPEED;
-	return startTime;
+	memset(displayText, 0, sizeof(displayText));
+	for (int i = 0; i < DISPLAY_LINES; i++)
+		displayDirty[i] = true; //blank the screen
+	startTask(displayService);
 }
 
 /*
-Resets x-axis to starting position
-Returns false if fails
-taskFailed updates to AXIS_FAILED (3) or NO_FAILURE (0)
+Watchdog: once armed, the main task must kick it at least every WATCHDOG_TIMEOUT
+If it does not (a hung loop or I2C transfer), watchdogTask stops every motor and multiplexer
+channel, records the last stall point, and locks the actuators so nothing restarts
 */
-bool resetWaterCycle(int& taskFailed)
+bool watchdogArmed = false;
+bool watchdogTripped = false;
+long watchdogKick = 0; //time of the last kick
+int watchdogPoint = STALL_NONE; //stall point of the last kick
+bool safetyMux[4]; //sensor ports with a multiplexer to stop (watchdog and emergency stop)
+bool muxStopPending[4]; //multiplexers skipped by a stop because their bus was busy (see retryMuxStops)
+
+long watchdogCount[STALL_POINTS]; //encoder count at the last progress kick of each stall point
+
+#ifdef ESTOP_BENCHMARK
+int estopTestPoint = STALL_NONE; //stall point the benchmark presses the emergency stop at...
+long estopTestAfter = 0; //...not before this time
+long estopTestPress = -1; //time of the injected press, -1 until pressed
+#endif
+
+void kickWatchdog(int stallPoint)
 {
-	bool executed = true; //assume no failure
-	float startTime = time1[T1];
-	nMotorEncoder[motorB] = 0; //error when combined in one line
-	nMotorEncoder[motorA] = 0;
-	
-	motor[motorB] = -X_AXIS_SPEED; //x-axis motors
-	motor[motorA] = -X_AXIS_SPEED;
-	while((abs(nMotorEncoder[motorA])*X_AXIS_CONVERSION_FACTOR < (X_AXIS_LENGTH+BUFFER_LENGTH))
-		&& (time1[T1] - startTime < MAX_X_AXIS_TIME))
-	{}
-	motor[motorB] = 0;
-	motor[motorA] = 0;
-	
-	if (time1[T1] - startTime > MAX_X_AXIS_TIME) //exceeded timer
-	{
-		taskFailed = AXIS_FAILED;
-		executed = false;
-	}
-	else if (SensorValue[S3] == 1) //emergency stop button
+	watchdogPoint = stallPoint;
+	watchdogKick = time1[T1];
+#ifdef ESTOP_BENCHMARK
+	if (stallPoint == estopTestPoint && estopTestPress < 0 && time1[T1] >= estopTestAfter)
+		estopTestPress = time1[T1]; //as if S3 were pressed now
+#endif
+}
+
+/*
+Kicks the watchdog from a motion loop only while its encoder moves, so a loop whose motor has
+stalled or whose end is never detected stops kicking (the first check of a motion may kick
+once against the count of the previous one)
+*/
+void kickOnProgress(int stallPoint, long count)
+{
+	if (abs(count - watchdogCount[stallPoint]) > STALL_COUNTS)
 	{
-		executed = false;
+		watchdogCount[stallPoint] = count;
+		kickWatchdog(stallPoint);
 	}
-	return executed;
 }
 
 /*
-Powers the motors to turn 90 degrees (at ROTATION_SPEED)
-Switches directions after 180 degrees (MAX_ROTATIONS)
-int& numRotations: number of rotations thus far
-bool& clockwise: true for CW, false for CCW
-Returns false if fails
-taskFailed updates to ROTATION_FAILED (1) or NO_FAILURE (0)
+Emergency stop: emergencyStopTask checks S3 every ESTOP_PERIOD whatever the main task is doing
+(every IDLE_POLL_TIME while idling, when the motors are already stopped and floating),
+stops every motor and latches the stop (the actuators stay locked off, the main task's loops end)
+estopLatency is measured up to the end of the last stop write: from detection on a real press (the
+press itself cannot be timed, it adds up to ESTOP_PERIOD), from the press in the ESTOP_BENCHMARK build
+*/
+bool emergencyStopped = false;
+long latchTime = 0; //when the watchdog or emergency stop stopped every motor (see accountActuator)
+long estopLatency = 0; //ms, last stop
+int estopPhase = STALL_NONE; //stall point of the last stop
+long estopStops = 0; //stops measured since start-up
+
+/*
+Shows a message for WAIT_MESSAGE (kicking the watchdog first)
 */
-bool rotateGreenhouse(int& numRotations, bool& clockwise, int& taskFailed)
+void waitMessage()
 {
-	bool executed = true;
-	float startTime = time1[T1];
-	if (numRotations == MAX_ROTATIONS)
+	kickWatchdog(STALL_MESSAGE);
+	wait1Msec(WAIT_MESSAGE);
+}
+
+#ifdef TRACE_MOTOR_COMMANDS
+long traceFile = -1; //file handle shared with the I2C hook in common.h
+long traceEvents = 0;
+long traceMismatches = 0;
+long traceFirstMismatch = -1; //event number of the first mismatch
+
+/*
+Reads the next whole number (may be negative) from a text file
+Returns false at end of file
+*/
+bool readTraceLong(long fileHandle, long& value)
+{
+	char ch = ' ';
+	while (ch == ' ' || ch == '\n' || ch == '\r')
 	{
-		clockwise = !clockwise; //change direction
-		numRotations = 0; //reset counter
+		if (!fileReadData(fileHandle, &ch, 1))
+			return false;
 	}
-	else
-		numRotations++;
-	
-	
-	if (clockwise)
-		MSMMotor(mmotor_S1_1, -ROTATION_SPEED); //CW
-	else
-		MSMMotor(mmotor_S1_1, ROTATION_SPEED); //CCW
-	
-	MSMMotorEncoderReset(mmotor_S1_1);
-	while((abs(MSMMotorEncoder(mmotor_S1_1))*ROTATION_CONVERSION_FACTOR < ROTATION_DISTANCE)
-		&& (time1[T1] - startTime < MAX_ROTATION_TIME)) //fail-safe
-	{}
-	MSMotorStop(mmotor_S1_1);
-	
-	if (time1[T1] - startTime > MAX_ROTATION_TIME) //exceeded timer
+	bool negative = (ch == '-');
+	if (negative && !fileReadData(fileHandle, &ch, 1))
+		return false;
+	value = 0;
+	while (ch >= '0' && ch <= '9')
 	{
-		taskFailed = ROTATION_FAILED;
-		executed = false;
+		value = value*10 + (ch - '0');
+		if (!fileReadData(fileHandle, &ch, 1))
+			ch = ' ';
 	}
-	return executed;
+	if (negative)
+		value = -value;
+	return true;
 }
 
 /*
-Checks if water is available
-Starts the pump and the 2D axis motors
-Stops pump
-Returns false if fails
-taskFailed updates as AXIS_FAILED (3), PUMP_FAILED (2), or NO_FAILURE (0)
+Records one motor command, or compares it with the next command of the golden trace
 */
-bool activateWaterCycle(int& taskFailed)
+void traceEvent(int type, int channel, long value)
 {
-	bool executed = true;
-	while (!checkFillLevel()) //no water
+	long now = time1[T1];
+	traceEvents++;
+	writeDebugStreamLine("%d %d %d %d", now, type, channel, value);
+	if (traceFile < 0)
+		return;
+#ifdef TRACE_COMPARE
+	long goldenTime = 0, goldenType = 0, goldenChannel = 0, goldenValue = 0;
+	bool found = readTraceLong(traceFile, goldenTime) && readTraceLong(traceFile, goldenType)
+		&& readTraceLong(traceFile, goldenChannel) && readTraceLong(traceFile, goldenValue);
+	if (!found || goldenType != type || goldenChannel != channel || goldenValue != value
+		|| abs(now - goldenTime) > TRACE_TIME_TOLERANCE)
 	{
-		displayFillLevel(); //prompts user until water is filled
+		if (traceMismatches == 0)
+			traceFirstMismatch = traceEvents;
+		traceMismatches++;
+		writeDebugStreamLine("TRACE MISMATCH, expected: %d %d %d %d", goldenTime, goldenType, goldenChannel, goldenValue);
 	}
-	float startTime = time1[T1]; // fail safe timer
-	clearScreen();
-	startPump();
+#else
+	char line[48];
+	sprintf(line, "%d %d %d %d\n", now, type, channel, value);
+	fileWriteData(traceFile, line, strlen(line));
+#endif
+}
 
-	//activate 2D axis (error caused when combined in one line)
-	nMotorEncoder[motorA] = 0;
-	nMotorEncoder[motorB] = 0;
-	nMotorEncoder[motorC] = 0;
-	motor[motorB] = X_AXIS_SPEED;
-	motor[motorA] = X_AXIS_SPEED;
-	motor[motorC] = Y_AXIS_SPEED;
-	
-	float xStartTime = time1[T1]; //fail safe
-	while((abs(nMotorEncoder[motorA])*X_AXIS_CONVERSION_FACTOR < X_AXIS_LENGTH)
-		&& (time1[T1] - xStartTime < MAX_X_AXIS_TIME) && (time1[T1] - startTime < MAX_PUMP_TIME)
-		&& (SensorValue[S3] == 0))
+/*
+Called by writeI2C in common.h for every command frame sent (replies are not traced,
+since encoder polling rates depend on loop timing)
+*/
+void traceI2CFrame(tSensors link, tByteArray& request)
+{
+	traceEvent(TRACE_I2C, (int)link, request[2]*256 + request[3]);
+}
+#endif
+
+/*
+Opens the trace (or golden trace) file; does nothing unless TRACE_MOTOR_COMMANDS is defined
+*/
+void startTrace()
+{
+#ifdef TRACE_MOTOR_COMMANDS
+#ifdef TRACE_COMPARE
+	traceFile = fileOpenRead(GOLDEN_TRACE_FILE);
+#else
+	traceFile = fileOpenWrite(TRACE_FILE);
+#endif
+#endif
+}
+
+/*
+Closes the trace and reports the result of a golden trace comparison
+*/
+void finishTrace()
+{
+#ifdef TRACE_MOTOR_COMMANDS
+	if (traceFile >= 0)
+		fileClose(traceFile);
+	traceFile = -1;
+#ifdef TRACE_COMPARE
+	char text[DISPLAY_TEXT_SIZE];
+	if (traceMismatches == 0)
+		sprintf(text, "Trace OK: %d commands", traceEvents);
+	else
+		sprintf(text, "Trace: %d bad, first #%d", traceMismatches, traceFirstMismatch);
+	showLine(6, text);
+	writeDebugStreamLine("Trace: %d commands, %d mismatches", traceEvents, traceMismatches);
+#endif
+#endif
+}
+
+/*
+Motor command funnel: every motor write and multiplexer command goes through these
+*/
+void driveMotor(tMotor motorPort, int power)
+{
+#ifdef TRACE_MOTOR_COMMANDS
+	traceEvent(TRACE_MOTOR, (int)motorPort, power);
+#endif
+	motor[motorPort] = power;
+}
+
+void driveMuxMotor(tI2CTransaction& frame, tMUXmotor muxmotor, int power)
+{
+#ifdef TRACE_MOTOR_COMMANDS
+	traceEvent(TRACE_MUX_MOTOR, (int)muxmotor, power);
+#endif
+	MSMMotor(frame, muxmotor, power);
+}
+
+void stopMuxMotor(tI2CTransaction& frame, tMUXmotor muxmotor)
+{
+#ifdef TRACE_MOTOR_COMMANDS
+	traceEvent(TRACE_MUX_STOP, (int)muxmotor, 0);
+#endif
+	MSMotorStop(frame, muxmotor);
+}
+
+/*
+Stops every brick motor directly (not through the actuators, so any task can)
+*/
+void stopBrickMotors()
+{
+	for (int i = 0; i < 4; i++)
+		driveMotor((tMotor)(motorA + i), 0);
+}
+
+/*
+Stops every multiplexer channel directly; stop commands jump the I2C queue (I2C_PRIO_SAFETY)
+With waitForBus false, multiplexers whose port has a transfer on the bus are skipped (a hung
+transfer would block the stop forever) and left pending for retryMuxStops
+Returns false if any multiplexer was skipped
+*/
+bool stopMuxChannels(bool waitForBus)
+{
+	tI2CTransaction frame;
+	bool stopped = true;
+	for (int link = 0; link < 4; link++)
 	{
-		// y-axis iterates multiple times while x-axis makes its first iteration
-		float yStartTime = time1[T1];
-		while((abs(nMotorEncoder[motorC])*Y_AXIS_CONVERSION_FACTOR < Y_AXIS_LENGTH)
-			&& (time1[T1] - yStartTime < MAX_Y_AXIS_TIME))
-		{}
-		motor[motorC] *= -1; //change y-axis direction
-		nMotorEncoder[motorC] = 0;
-		if (time1[T1] - yStartTime > MAX_Y_AXIS_TIME) //exceeded y-axis timer
+		if (safetyMux[link] && !waitForBus && I2CPortBusy[link])
 		{
-			taskFailed = AXIS_FAILED;
-			executed = false;
+			muxStopPending[link] = true;
+			stopped = false;
+		}
+		else if (safetyMux[link])
+		{
+			MSMotorStopBoth(frame, (tSensors)link, true);
+			muxStopPending[link] = false;
 		}
 	}
-	if (SensorValue[S3] == 1) //emergency button pressed
+	return stopped;
+}
+
+/*
+Stops the multiplexers a stop had to skip, as soon as their bus is free
+*/
+void retryMuxStops()
+{
+	tI2CTransaction frame;
+	for (int link = 0; link < 4; link++)
+	{
+		if (muxStopPending[link] && !I2CPortBusy[link])
 		{
-			executed = false;
+			MSMotorStopBoth(frame, (tSensors)link, true);
+			muxStopPending[link] = false;
 		}
-	motor[motorC] = 0; //stop axis
-	motor[motorA] = 0;
-	motor[motorB] = 0;
-	motor[motorD] = 0; //stop pump
-	
-	if (time1[T1] - xStartTime > MAX_X_AXIS_TIME) //exceeded x-axis timer
+	}
+}
+
+void stopAllMotors()
+{
+	stopBrickMotors();
+	stopMuxChannels(true);
+}
+
+/*
+Stops the brick motors, records the stall point, then stops the multiplexers that are not stuck on the bus
+(watchdogTask keeps retrying the others)
+*/
+void tripWatchdog()
+{
+	latchTime = time1[T1];
+	watchdogTripped = true; //locks the actuators
+	stopBrickMotors();
+	long fileHandle = fileOpenWrite(WATCHDOG_FILE);
+	if (fileHandle >= 0)
 	{
-		taskFailed = AXIS_FAILED;
-		executed = false;
+		char line[48];
+		sprintf(line, "stall point %d at %d ms\n", watchdogPoint, watchdogKick);
+		fileWriteData(fileHandle, line, strlen(line));
+		fileClose(fileHandle);
 	}
-	else if (time1[T1] - startTime > MAX_PUMP_TIME) //exceeded pump timer
+	stopMuxChannels(false);
+}
+
+task watchdogTask()
+{
+	long woke = time1[T1];
+	while (true)
 	{
-		taskFailed = PUMP_FAILED;
-		executed = false;
+		if (watchdogArmed && !watchdogTripped && (time1[T1] - watchdogKick > WATCHDOG_TIMEOUT))
+			tripWatchdog();
+		else if (watchdogTripped)
+			retryMuxStops();
+		serviceWait(WATCHDOG_PERIOD, woke);
+	}
+}
+
+task emergencyStopTask()
+{
+	long woke = time1[T1];
+	while (!emergencyStopped)
+	{
+		long pressed = -1;
+		if (SensorValue[S3] == 1)
+			pressed = time1[T1]; //detected now, the press itself is not known
+#ifdef ESTOP_BENCHMARK
+		if (estopTestPress >= 0)
+			pressed = estopTestPress;
+#endif
+		if (pressed >= 0)
+		{
+			latchTime = time1[T1];
+			estopPhase = watchdogPoint;
+			emergencyStopped = true; //locks the actuators before stopping them
+			stopAllMotors();
+			estopLatency = time1[T1] - pressed;
+			estopStops++;
+		}
+		else
+			serviceWait(ESTOP_PERIOD, woke);
 	}
-	
-	return executed;
 }
 
 /*
-Prompts the user to enter the current time and saves to float variables
+An actuator is a brick motor port or a multiplexer motor channel
 */
-void setStartTime(float& hour, float& minute, float& period)
+typedef struct
 {
+	bool connected; //false if the bed has no such motor
+	bool onMux; //multiplexer channel instead of brick motor port
+	tMotor port;
+	tMUXmotor muxPort;
+	int power; //last commanded power
+	tI2CTransaction frame; //request frame reused for every multiplexer command
+	long lastChange; //time of the last power change
+	long onTime; //ms powered
+	float energy; //estimated J (commanded power integrated over time)
+} tActuator;
 
-	// prompt user
-	displayTextLine(3, "Please enter the current time:");
-	wait1Msec(WAIT_MESSAGE);
-	displayTextLine(3, "Use up/down arrows change #s");
-	displayTextLine(4, "Use enter to go next");
-	wait1Msec(WAIT_MESSAGE);
-	displayTextLine(3, "Please enter the current time:");
+void resetActuatorEnergy(tActuator& actuator)
+{
+	actuator.lastChange = time1[T1];
+	actuator.onTime = 0;
+	actuator.energy = 0;
+}
 
-	// generate time as user changes it
-	int timeSet = 0;
-	/*
-		setTime = 0; Change hours
-		setTime = 1; Change minutes
-		setTime = 2; Change period (a.m./p.m.)
-	*/
-	
-	string periodDisplay = "a.m.";
-	
-	while (timeSet != 2)
+void setBrickActuator(tActuator& actuator, tMotor port)
+{
+	actuator.connected = true;
+	actuator.onMux = false;
+	actuator.port = port;
+	actuator.power = 0;
+	resetActuatorEnergy(actuator);
+}
+
+void setMuxActuator(tActuator& actuator, tMUXmotor muxPort)
+{
+	actuator.connected = true;
+	actuator.onMux = true;
+	actuator.muxPort = muxPort;
+	actuator.power = 0;
+	resetActuatorEnergy(actuator);
+}
+
+void disconnectActuator(tActuator& actuator)
+{
+	actuator.connected = false;
+	actuator.power = 0;
+	resetActuatorEnergy(actuator);
+}
+
+/*
+Adds the time since the last power change to the actuator's on time and energy
+(energy: MOTOR_RATED_POWER scaled by the commanded power)
+The watchdog and emergency stop stop the motors without going through the actuators, so an actuator
+still powered after the latch is counted up to latchTime and then zeroed
+*/
+void accountActuator(tActuator& actuator)
+{
+	long now = time1[T1];
+	bool latched = (watchdogTripped || emergencyStopped) && (actuator.power != 0);
+	if (latched)
+		now = max2(actuator.lastChange, latchTime);
+	if (actuator.power != 0)
 	{
-		// generate updated time after toggling
-		if (minute< 10) displayTextLine(4, "%d:0%d %s", hour, minute, periodDisplay);
-		else displayTextLine(4, "%d:%d %s", hour, minute, periodDisplay);
+		actuator.onTime += now - actuator.lastChange;
+		actuator.energy += abs(actuator.power)/100.0*MOTOR_RATED_POWER*(now - actuator.lastChange)/1000.0;
+	}
+	if (latched)
+		actuator.power = 0;
+	actuator.lastChange = time1[T1];
+}
 
-		// toggle settings
-		while(!getButtonPress(buttonAny))
-		{}
-		if (getButtonPress(buttonDown))
-		{
-			if (timeSet == 0 && hour>1) hour--;
-			else if (timeSet == 1 && minute>0) minute--;
-		}
-		else if (getButtonPress(buttonUp))
-		{
-			if (timeSet == 0 && hour < 12) hour++;
-			else if (timeSet == 1 && minute < 59) minute++;
+void commandActuator(tActuator& actuator, int power)
+{
+	accountActuator(actuator);
+	actuator.power = power;
+	if (!actuator.onMux)
+		driveMotor(actuator.port, power);
+	else if (power == 0)
+		stopMuxMotor(actuator.frame, actuator.muxPort);
+	else
+		driveMuxMotor(actuator.frame, actuator.muxPort, power);
+}
+
+/*
+Powers an actuator (multiplexer channels are stopped, not powered, at 0)
+The stop latch is checked again once the command is out: a stop that came in between the check
+and the command (the stop task may run in between, or its stop may jump the queued command on
+the bus) would otherwise be undone by it
+*/
+void driveActuator(tActuator& actuator, int power)
+{
+	if (!actuator.connected)
+		return;
+	if (watchdogTripped || emergencyStopped) //locked off until restarted
+		power = 0;
+	commandActuator(actuator, power);
+	if (power != 0 && (watchdogTripped || emergencyStopped))
+		commandActuator(actuator, 0);
+}
+
+long actuatorEncoder(tActuator& actuator)
+{
+	if (!actuator.connected)
+		return 0;
+	if (actuator.onMux)
+		return MSMMotorEncoder(actuator.frame, actuator.muxPort);
+	return nMotorEncoder[actuator.port];
+}
+
+void resetActuatorEncoder(tActuator& actuator)
+{
+	if (!actuator.connected)
+		return;
+	if (actuator.onMux)
+		MSMMotorEncoderReset(actuator.frame, actuator.muxPort);
+	else
+		nMotorEncoder[actuator.port] = 0;
+}
+
+/*
+Wall clock: the start time entered in setStartTime plus the run time (also before a restart)
+A resumed schedule carries on from the saved clock (time switched off is not counted) unless the time is reset
+*/
+long clockStart = 0; //ms after midnight at run time 0
+long clockRunTime = 0; //run time carried over from before this boot
+
+/*
+Returns a 12 hour clock time (period 1: p.m.) in ms after midnight
+*/
+long clockTime(float hour, float minute, float period)
+{
+	return ((((long)hour % 12) + 12*(long)period)*60 + (long)minute)*60000;
+}
+
+/*
+Starts the clock from the start time (the time of day at run time 0)
+*/
+void setClock(float hour, float minute, float period, long runTime)
+{
+	clockStart = clockTime(hour, minute, period);
+	clockRunTime = runTime;
+}
+
+/*
+Sets the clock to the time of day now, keeping the run time (after a restart, when the start time
+plus the run time misses the time the brick was switched off)
+*/
+void setClockNow(float hour, float minute, float period)
+{
+	clockStart = ((clockTime(hour, minute, period) - (clockRunTime + time1[T1])) % DAY_LENGTH + DAY_LENGTH) % DAY_LENGTH;
+}
+
+/*
+Returns the time in ms after midnight of the start day (DAY_LENGTH per day since)
+*/
+long wallClock()
+{
+	return clockStart + clockRunTime + time1[T1];
+}
+
+/*
+Returns the daylight (SUNRISE_TIME to SUNSET_TIME) between two wall clock times, in ms
+*/
+long daylightBetween(long start, long end)
+{
+	long daylight = 0;
+	while (start < end)
+	{
+		long midnight = start - start % DAY_LENGTH;
+		long from = midnight + SUNRISE_TIME;
+		long to = midnight + SUNSET_TIME;
+		if (from < start)
+			from = start;
+		if (to > end)
+			to = end;
+		if (to > from)
+			daylight += to - from;
+		start = midnight + DAY_LENGTH;
+	}
+	return daylight;
+}
+
+/*
+Wall clock rules of the water and rotation jobs (indexed by JOB_WATER, JOB_ROTATE; times in ms after midnight)
+A job with times runs at each of them instead of every period; no job starts in its quiet hours,
+its deadline moves to their end instead
+*/
+typedef struct
+{
+	int numTimes[CLOCK_RULE_KINDS];
+	long times[CLOCK_RULE_KINDS*MAX_CLOCK_TIMES]; //kind*MAX_CLOCK_TIMES + time
+	bool quiet[CLOCK_RULE_KINDS];
+	long quietStart[CLOCK_RULE_KINDS];
+	long quietEnd[CLOCK_RULE_KINDS]; //may be before quietStart (over midnight)
+} tClockRules;
+
+void clearClockRules(tClockRules& rules)
+{
+	for (int i = 0; i < CLOCK_RULE_KINDS; i++)
+	{
+		rules.numTimes[i] = 0;
+		rules.quiet[i] = false;
+	}
+}
+
+/*
+Returns the time of day (ms after midnight) at a T1 time
+*/
+long timeOfDay(long t1Time)
+{
+	return (clockStart + clockRunTime + t1Time) % DAY_LENGTH;
+}
+
+/*
+Applies the wall clock rules of a job kind to a deadline (T1 time, from the job's period)
+Returns the deadline to use: the next of the job's times after now, if it has any,
+moved to the end of its quiet hours if it falls within them
+*/
+long clockRuleDeadline(tClockRules& rules, int kind, long deadline)
+{
+	if (kind < 0 || kind >= CLOCK_RULE_KINDS)
+		return deadline;
+	if (rules.numTimes[kind] > 0)
+	{
+		long now = time1[T1];
+		long today = timeOfDay(now);
+		long wait = DAY_LENGTH;
+		for (int i = 0; i < rules.numTimes[kind]; i++)
+		{
+			long untilTime = (rules.times[kind*MAX_CLOCK_TIMES + i] - today + DAY_LENGTH) % DAY_LENGTH;
+			if (untilTime > 0 && untilTime < wait) //0: the time that just ran
+				wait = untilTime;
+		}
+		deadline = now + wait;
+	}
+	if (rules.quiet[kind])
+	{
+		long start = rules.quietStart[kind];
+		long end = rules.quietEnd[kind];
+		long at = timeOfDay(deadline);
+		bool inQuiet = (start <= end) ? (at >= start && at < end) : (at >= start || at < end);
+		if (inQuiet)
+			deadline += (end - at + DAY_LENGTH) % DAY_LENGTH;
+	}
+	return deadline;
+}
+
+/*
+Multiplexer PID gains found by tuneRotation (register values, see MSMMUXsetPID)
+*/
+typedef struct
+{
+	bool tuned; //false: factory gains
+	long kpTacho;
+	long kiTacho;
+	long kdTacho;
+	long kpSpeed;
+	long kiSpeed;
+	long kdSpeed;
+} tPidGains;
+
+/*
+Travel (encoder counts) and fail-safe times (ms) of a bed, measured by calibrateBed
+Until then the values come from the empirical constants (see defaultCalibration)
+*/
+typedef struct
+{
+	bool calibrated;
+	long xTravel; //x axis during a water cycle (X_AXIS_LENGTH)
+	long xReturn; //x axis back to the start (X_AXIS_LENGTH + BUFFER_LENGTH)
+	long yTravel; //one y axis pass (Y_AXIS_LENGTH)
+	long rotationTravel; //quarter turn (ROTATION_DISTANCE)
+	long maxXTime;
+	long maxYTime;
+	long maxPumpTime;
+	long maxRotationTime;
+} tCalibration;
+
+/*
+One greenhouse bed: its motors, tank sensor, schedule and counters
+*/
+typedef struct
+{
+	string name;
+	tActuator rotation; //greenhouse base
+	tPidGains rotationPid;
+	tCalibration calibration;
+	tActuator xAxis; //x direction, encoder used for position
+	tActuator xAxis2; //second x direction motor, if any
+	tActuator yAxis;
+	tActuator pump;
+	tSensors fillSensor; //colour sensor watching the tank float
+	float waterInterval; //ms
+	float rotationInterval; //ms
+	int pumpSpeed; //dose
+	bool adaptive; //interval and dose follow the demand (see adaptWatering)
+	float baseWaterInterval; //configured schedule the demand is relative to
+	int basePumpSpeed;
+	float demand; //last demand
+	int moisturePort; //soil moisture sensor port (0-3), -1 for none
+	long moistureDry; //raw readings of dry and wet soil
+	long moistureWet;
+	float moistureTarget; //percent
+	float xSpan; //coverage: fraction of the calibrated x travel swept
+	float ySpan; //coverage: fraction of the calibrated y travel swept
+	int waterJob; //scheduler jobs
+	int rotationJob;
+	int orientation; //quarter turns from the start (MIN_ORIENTATION to MAX_ORIENTATION), or ORIENTATION_UNKNOWN
+	bool clockwise; //direction of the last turn
+	long faceExposure[4]; //ms of daylight each side of the plant has faced the light
+	long exposureClock; //wall clock time the exposure is counted up to
+	long waterElapsed; //time since last cycle, carried over a restart
+	long rotationElapsed;
+	long waterCycles;
+	long rotationCycles;
+	long pumpTime; //ms pumped since start-up, for the consumption model
+	long pumpCycles; //water cycles since start-up
+	float pumpedWater; //ml delivered since start-up (pump time at the power used)
+	long turnCycles; //rotations since start-up
+	long coverage[COVERAGE_CELLS]; //ms pumped over each cell (x cell*COVERAGE_Y_CELLS + y cell) since start-up
+	long coverageClock; //time of the last coverage sample
+	int numZones; //0: every cycle sweeps the whole bed
+	long zoneX1[MAX_ZONES]; //rectangle in encoder counts from the start corner
+	long zoneX2[MAX_ZONES];
+	long zoneY1[MAX_ZONES];
+	long zoneY2[MAX_ZONES];
+	float zoneInterval[MAX_ZONES]; //ms
+	int zonePumpSpeed[MAX_ZONES]; //dose, 0: the bed's pumpSpeed
+	long zoneLastWater[MAX_ZONES]; //time of the zone's last watering
+} tBed;
+
+typedef struct
+{
+	int numBeds;
+	int failedBed; //bed that caused a failure, -1 for none
+	tBed bed[MAX_BEDS];
+	tClockRules rules;
+} tGreenhouse;
+
+/*
+Resets a bed's schedule state (nothing carried over)
+*/
+void resetBedState(tBed& bed)
+{
+	bed.orientation = 0; //no turns yet
+	bed.clockwise = true;
+	for (int i = 0; i < 4; i++)
+		bed.faceExposure[i] = 0;
+	bed.exposureClock = 0; //set once the clock is known
+	bed.waterElapsed = 0;
+	bed.rotationElapsed = 0;
+	bed.waterCycles = 0;
+	bed.rotationCycles = 0;
+	bed.pumpTime = 0;
+	bed.pumpCycles = 0;
+	bed.pumpedWater = 0;
+	bed.turnCycles = 0;
+	for (int i = 0; i < COVERAGE_CELLS; i++)
+		bed.coverage[i] = 0;
+	bed.waterJob = -1;
+	bed.rotationJob = -1;
+}
+
+/*
+Full dose over the whole bed (no preset)
+*/
+void setFullCoverage(tBed& bed)
+{
+	bed.pumpSpeed = PUMP_SPEED;
+	bed.xSpan = 1.0;
+	bed.ySpan = 1.0;
+}
+
+/*
+Calibration from the empirical constants
+*/
+void defaultCalibration(tCalibration& calibration)
+{
+	calibration.calibrated = false;
+	calibration.xTravel = X_AXIS_LENGTH/X_AXIS_CONVERSION_FACTOR;
+	calibration.xReturn = (X_AXIS_LENGTH+BUFFER_LENGTH)/X_AXIS_CONVERSION_FACTOR;
+	calibration.yTravel = Y_AXIS_LENGTH/Y_AXIS_CONVERSION_FACTOR;
+	calibration.rotationTravel = ROTATION_DISTANCE/ROTATION_CONVERSION_FACTOR;
+	calibration.maxXTime = MAX_X_AXIS_TIME;
+	calibration.maxYTime = MAX_Y_AXIS_TIME;
+	calibration.maxPumpTime = MAX_PUMP_TIME;
+	calibration.maxRotationTime = MAX_ROTATION_TIME;
+}
+
+/*
+MOTOR A: x direction on 2D axis (1)
+MOTOR B: x direction on 2D axis (2)
+MOTOR C: y direction on 2D axis
+MOTOR D: peristaltic pump
+MULTIPLEXER M1: rotation of greenhouse base
+Further beds use multiplexer channels (see the bed setting in loadConfig)
+*/
+void initFirstBed(tBed& bed)
+{
+	bed.name = " ";
+	setMuxActuator(bed.rotation, mmotor_S1_1);
+	setBrickActuator(bed.xAxis, motorA);
+	setBrickActuator(bed.xAxis2, motorB);
+	setBrickActuator(bed.yAxis, motorC);
+	setBrickActuator(bed.pump, motorD);
+	bed.fillSensor = S4;
+	bed.waterInterval = 0; //set by applyUserSettings
+	bed.rotationInterval = 0;
+	setFullCoverage(bed);
+	bed.adaptive = false;
+	bed.demand = 1;
+	bed.moisturePort = -1;
+	bed.numZones = 0;
+	bed.rotationPid.tuned = false;
+	defaultCalibration(bed.calibration);
+	resetBedState(bed);
+}
+
+void initGreenhouse(tGreenhouse& greenhouse)
+{
+	greenhouse.numBeds = 1;
+	greenhouse.failedBed = -1;
+	initFirstBed(greenhouse.bed[0]);
+	clearClockRules(greenhouse.rules);
+}
+
+/*
+Gives the first bed the user's plant name, and every bed without its own intervals the user's intervals
+*/
+void applyUserSettings(tGreenhouse& greenhouse, string& plantName, float waterInterval, float rotationInterval)
+{
+	greenhouse.bed[0].name = plantName;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (greenhouse.bed[i].waterInterval <= 0)
+			greenhouse.bed[i].waterInterval = waterInterval;
+		if (greenhouse.bed[i].rotationInterval <= 0)
+			greenhouse.bed[i].rotationInterval = rotationInterval;
+		greenhouse.bed[i].baseWaterInterval = greenhouse.bed[i].waterInterval;
+		greenhouse.bed[i].basePumpSpeed = greenhouse.bed[i].pumpSpeed;
+	}
+}
+
+/*
+Copies a preset's name into name (at least CONFIG_NAME_SIZE characters)
+*/
+void presetName(int preset, char* name)
+{
+	switch (preset)
+	{
+		case PRESET_SUCCULENT: strcpy(name, "succulent"); break;
+		case PRESET_FERN: strcpy(name, "fern"); break;
+		case PRESET_HERB: strcpy(name, "herb"); break;
+		case PRESET_FLOWER: strcpy(name, "flower"); break;
+		default: strcpy(name, "none"); break;
+	}
+}
+
+/*
+Returns the preset called name, or PRESET_NONE
+*/
+int findPreset(const char* name)
+{
+	char candidate[CONFIG_NAME_SIZE];
+	for (int i = 0; i < NUM_PRESETS; i++)
+	{
+		presetName(i, candidate);
+		if (strcmp(candidate, name) == 0)
+			return i;
+	}
+	return PRESET_NONE;
+}
+
+/*
+Sets the intervals from a plant preset, and the dose and coverage of every bed
+Beds with their own intervals keep them (see applyUserSettings); PRESET_NONE changes nothing
+*/
+void applyPlantPreset(tGreenhouse& greenhouse, int preset, float& waterInterval, float& rotationInterval)
+{
+	if (preset < 0 || preset >= NUM_PRESETS)
+		return;
+	waterInterval = PRESET_WATER_INTERVAL[preset];
+	rotationInterval = PRESET_ROTATION_INTERVAL[preset];
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		greenhouse.bed[i].pumpSpeed = PRESET_PUMP_SPEED[preset];
+		greenhouse.bed[i].xSpan = PRESET_X_SPAN[preset];
+		greenhouse.bed[i].ySpan = PRESET_Y_SPAN[preset];
+	}
+}
+
+/*
+Configures a sensor port for every multiplexer channel and tank sensor in use
+*/
+void configureMuxPort(tActuator& actuator)
+{
+	if (actuator.connected && actuator.onMux)
+		SensorType[(tSensors)SPORT(actuator.muxPort)] = sensorI2CCustom;
+}
+
+void configureBedSensors(tBed& bed)
+{
+	configureMuxPort(bed.rotation);
+	configureMuxPort(bed.xAxis);
+	configureMuxPort(bed.xAxis2);
+	configureMuxPort(bed.yAxis);
+	configureMuxPort(bed.pump);
+	SensorType[bed.fillSensor] = sensorEV3_Color;
+	wait1Msec(50);
+	SensorMode[bed.fillSensor] = modeEV3Color_Color;
+	wait1Msec(50);
+	if (bed.moisturePort >= 0)
+		SensorType[(tSensors)bed.moisturePort] = sensorAnalogInactive;
+}
+
+/*
+Marks the multiplexers of every bed, for stopAllMotors
+*/
+void setSafetyMux(tGreenhouse& greenhouse)
+{
+	for (int link = 0; link < 4; link++)
+	{
+		safetyMux[link] = false;
+		muxStopPending[link] = false;
+	}
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (greenhouse.bed[i].rotation.connected && greenhouse.bed[i].rotation.onMux)
+			safetyMux[SPORT(greenhouse.bed[i].rotation.muxPort)] = true;
+		if (greenhouse.bed[i].xAxis.connected && greenhouse.bed[i].xAxis.onMux)
+			safetyMux[SPORT(greenhouse.bed[i].xAxis.muxPort)] = true;
+		if (greenhouse.bed[i].xAxis2.connected && greenhouse.bed[i].xAxis2.onMux)
+			safetyMux[SPORT(greenhouse.bed[i].xAxis2.muxPort)] = true;
+		if (greenhouse.bed[i].yAxis.connected && greenhouse.bed[i].yAxis.onMux)
+			safetyMux[SPORT(greenhouse.bed[i].yAxis.muxPort)] = true;
+		if (greenhouse.bed[i].pump.connected && greenhouse.bed[i].pump.onMux)
+			safetyMux[SPORT(greenhouse.bed[i].pump.muxPort)] = true;
+	}
+}
+
+/*
+Starts the emergency stop (from now on S3 stops everything, within ESTOP_PERIOD plus the stop commands)
+*/
+void startEmergencyStop(tGreenhouse& greenhouse)
+{
+	setSafetyMux(greenhouse);
+	startTask(emergencyStopTask, kHighPriority);
+}
+
+/*
+Starts the watchdog (stopAllMotors uses the multiplexers marked by startEmergencyStop)
+*/
+void armWatchdog()
+{
+	memset(watchdogCount, 0, sizeof(watchdogCount));
+	kickWatchdog(STALL_NONE);
+	watchdogArmed = true;
+	startTask(watchdogTask, kHighPriority);
+}
+
+/*
+SENSOR 1: multiplexer
+SENSOR 3: touch
+SENSOR 4: colour sensor
+(and the multiplexer and colour sensor ports of any further beds)
+*/
+void configureSensors(tGreenhouse& greenhouse)
+{
+	SensorType[S1] = sensorI2CCustom;
+	wait1Msec(50);
+	SensorType[S3] = sensorEV3_Touch;
+	wait1Msec(50);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		configureBedSensors(greenhouse.bed[i]);
+}
+
+/*
+Stops every motor of a bed
+*/
+void stopBed(tBed& bed)
+{
+	driveActuator(bed.pump, 0);
+	driveActuator(bed.yAxis, 0);
+	driveActuator(bed.xAxis, 0);
+	driveActuator(bed.xAxis2, 0);
+	driveActuator(bed.rotation, 0);
+}
+
+/*
+Low-power idle: slow polling in every task, blank screen, motors floating (not holding position)
+idleTime with idleBusyTime and idleWakeups gives the CPU duty and wake-up rate of all tasks while idle
+*/
+long idleTime = 0; //ms spent idle
+long startBatteryLevel = 0; //mV at start-up, for the battery estimate
+
+void setActuatorFloat(tActuator& actuator, bool floating)
+{
+	if (!actuator.connected)
+		return;
+	if (actuator.onMux && floating)
+		MSMMotorSetFloat(actuator.muxPort);
+	else if (actuator.onMux)
+		MSMMotorSetBrake(actuator.muxPort);
+	else if (floating)
+		setMotorBrakeMode(actuator.port, motorCoast);
+	else
+		setMotorBrakeMode(actuator.port, motorBrake);
+}
+
+void setBedFloat(tBed& bed, bool floating)
+{
+	setActuatorFloat(bed.rotation, floating);
+	setActuatorFloat(bed.xAxis, floating);
+	setActuatorFloat(bed.xAxis2, floating);
+	setActuatorFloat(bed.yAxis, floating);
+	setActuatorFloat(bed.pump, floating);
+}
+
+/*
+Waits until wakeTime, a button press or the emergency stop
+After IDLE_DELAY without activity (since lastActivity) the greenhouse idles until woken
+*/
+void idleWait(tGreenhouse& greenhouse, long wakeTime, long lastActivity)
+{
+	bool idle = false;
+	long idleStart = 0;
+	long woke = time1[T1];
+	while (!getButtonPress(buttonAny) && (time1[T1] < wakeTime) && (SensorValue[S3] == 0) && !emergencyStopped)
+	{
+		kickWatchdog(STALL_IDLE);
+		if (!idle && (time1[T1] - lastActivity >= IDLE_DELAY))
+		{
+			idle = true;
+			idleStart = time1[T1];
+			idling = true;
+			for (int i = 0; i < DISPLAY_LINES; i++)
+				showLine(i, "");
+			for (int i = 0; i < greenhouse.numBeds; i++)
+			{
+				setBedFloat(greenhouse.bed[i], true);
+				stopBed(greenhouse.bed[i]); //stops again, now floating
+			}
+		}
+		long pollTime = ACTIVE_POLL_TIME;
+		if (idle)
+			pollTime = IDLE_POLL_TIME;
+		if (wakeTime - time1[T1] < pollTime)
+			pollTime = wakeTime - time1[T1];
+		if (idle)
+			countIdlePoll(woke);
+		if (pollTime > 0)
+			wait1Msec(pollTime);
+		woke = time1[T1];
+	}
+	if (idle)
+	{
+		idling = false;
+		idleTime += time1[T1] - idleStart;
+		for (int i = 0; i < greenhouse.numBeds; i++)
+			setBedFloat(greenhouse.bed[i], false); //cycles stop with the brake again
+	}
+}
+
+void clearScreen()
+{
+	showLine(3, "");
+	showLine(4, "");
+	showLine(5, "");
+	showLine(6, "");
+}
+
+/*
+Water level service: samples every tank sensor in use every TANK_SAMPLE_TIME (IDLE_POLL_TIME while idling) and
+publishes a stable level per sensor port, so a single misread never starts or stops a cycle
+Calibrated gauges: median of the last TANK_MEDIAN reflected light readings, interpolated between
+the calibration points (hysteresis between TANK_EMPTY_LEVEL and TANK_FULL_LEVEL)
+Otherwise: vote over the last TANK_WINDOW float colours (hysteresis between TANK_EMPTY_VOTES and TANK_FULL_VOTES)
+*/
+bool tankWatched[4]; //sensor port has a tank sensor
+long tankHistory[4]; //last TANK_WINDOW samples, one bit each (1: water)
+bool tankGauged[4]; //calibrated gauge
+long tankGaugeRaw[4*TANK_GAUGE_POINTS]; //reflected light at each calibration point (port*TANK_GAUGE_POINTS + point)
+long tankRawHistory[4*TANK_MEDIAN]; //last TANK_MEDIAN readings (port*TANK_MEDIAN + sample)
+int tankRawNext[4]; //next sample to replace
+bool tankWater[4]; //published level
+float tankLevel[4]; //published level, percent full (0 or 100 without a gauge)
+int tankRefills[4]; //published changes to water...
+int tankEmpties[4]; //...and to empty
+
+bool sampleTank(tSensors fillSensor)
+{
+	return (SensorValue[fillSensor] != (int)colorWhite); //white: no water, ping pong ball at bottom
+}
+
+/*
+Fill height (percent) of a calibration point
+*/
+float gaugePointLevel(int point)
+{
+	return 100.0*point/(TANK_GAUGE_POINTS - 1);
+}
+
+/*
+Converts a reflected light reading to percent full (piecewise linear between the calibration points)
+*/
+float gaugeLevel(int port, long raw)
+{
+	int first = port*TANK_GAUGE_POINTS;
+	for (int i = 0; i < TANK_GAUGE_POINTS - 1; i++)
+	{
+		long low = tankGaugeRaw[first + i];
+		long high = tankGaugeRaw[first + i + 1];
+		if ((raw >= low && raw <= high) || (raw <= low && raw >= high))
+		{
+			if (low == high)
+				return gaugePointLevel(i);
+			return gaugePointLevel(i) + (gaugePointLevel(i + 1) - gaugePointLevel(i))*(raw - low)/(float)(high - low);
+		}
+	}
+	//outside the calibrated range: nearest end
+	if (abs(raw - tankGaugeRaw[first]) < abs(raw - tankGaugeRaw[first + TANK_GAUGE_POINTS - 1]))
+		return 0;
+	return 100;
+}
+
+/*
+Median of the last TANK_MEDIAN readings of a gauge
+*/
+long tankMedian(int port)
+{
+	long sorted[TANK_MEDIAN];
+	for (int i = 0; i < TANK_MEDIAN; i++)
+	{
+		long value = tankRawHistory[port*TANK_MEDIAN + i];
+		int j = i;
+		while (j > 0 && sorted[j - 1] > value)
+		{
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = value;
+	}
+	return sorted[TANK_MEDIAN/2];
+}
+
+void publishTank(int port, bool water)
+{
+	tankWater[port] = water;
+	if (water)
+		tankRefills[port]++;
+	else
+		tankEmpties[port]++;
+}
+
+void updateGauge(int port)
+{
+	tankRawHistory[port*TANK_MEDIAN + tankRawNext[port]] = SensorValue[(tSensors)port];
+	tankRawNext[port] = (tankRawNext[port] + 1) % TANK_MEDIAN;
+	tankLevel[port] = gaugeLevel(port, tankMedian(port));
+	if (!tankWater[port] && tankLevel[port] > TANK_FULL_LEVEL)
+		publishTank(port, true);
+	else if (tankWater[port] && tankLevel[port] <= TANK_EMPTY_LEVEL)
+		publishTank(port, false);
+}
+
+void updateTank(int port)
+{
+	if (tankGauged[port])
+	{
+		updateGauge(port);
+		return;
+	}
+	long sample = 0;
+	if (sampleTank((tSensors)port))
+		sample = 1;
+	tankHistory[port] = ((tankHistory[port] << 1) | sample) & ((1 << TANK_WINDOW) - 1);
+	int votes = 0;
+	for (int i = 0; i < TANK_WINDOW; i++)
+		votes += (tankHistory[port] >> i) & 1;
+	if (!tankWater[port] && votes >= TANK_FULL_VOTES)
+		publishTank(port, true);
+	else if (tankWater[port] && votes <= TANK_EMPTY_VOTES)
+		publishTank(port, false);
+	tankLevel[port] = 0;
+	if (tankWater[port])
+		tankLevel[port] = 100;
+}
+
+task waterLevelService()
+{
+	long woke = time1[T1];
+	while (true)
+	{
+		for (int port = 0; port < 4; port++)
+		{
+			if (tankWatched[port])
+				updateTank(port);
+		}
+		serviceWait(TANK_SAMPLE_TIME, woke);
+	}
+}
+
+/*
+Tank consumption model (kept by the main task): the water pumped into a tank's beds is counted
+against the tank since its last refill, and the capacity is learned from the water pumped
+before the tank ran dry
+*/
+float tankUsed[4]; //ml pumped since the last refill
+float tankCapacity[4]; //ml
+int tankRefillsSeen[4]; //service counts already applied to the model
+int tankEmptiesSeen[4];
+
+void updateTankModel(int port)
+{
+	if (tankEmpties[port] != tankEmptiesSeen[port]) //ran dry: everything pumped since the refill
+	{
+		tankEmptiesSeen[port] = tankEmpties[port];
+		if (tankUsed[port] > 0)
+			tankCapacity[port] = tankUsed[port];
+	}
+	if (tankRefills[port] != tankRefillsSeen[port])
+	{
+		tankRefillsSeen[port] = tankRefills[port];
+		tankUsed[port] = 0;
+	}
+}
+
+/*
+Counts pumping at a pump power against the bed's tank (the water cycle counts itself in pumpCycles)
+*/
+void recordDose(tBed& bed, long pumpTime, int power)
+{
+	float pumped = pumpTime/1000.0*PUMP_FLOW_RATE*power/PUMP_SPEED; //flow scales with the pump power
+	bed.pumpTime += pumpTime;
+	bed.pumpedWater += pumped;
+	updateTankModel(bed.fillSensor);
+	tankUsed[bed.fillSensor] += pumped;
+}
+
+/*
+Returns the water left in a tank (ml), from the gauge if calibrated, otherwise from the model
+*/
+float tankRemaining(int port)
+{
+	updateTankModel(port);
+	if (!tankWater[port])
+		return 0;
+	if (tankGauged[port])
+		return tankLevel[port]/100*tankCapacity[port];
+	if (tankUsed[port] >= tankCapacity[port])
+		return 0;
+	return tankCapacity[port] - tankUsed[port];
+}
+
+/*
+Forecasts when a tank runs dry, from the average dose and water interval of every bed it feeds
+Returns the time to empty (ms), or -1 if nothing has been pumped yet
+*/
+long tankTimeToEmpty(tGreenhouse& greenhouse, int port)
+{
+	float rate = 0; //ml per ms
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (greenhouse.bed[i].fillSensor == port && greenhouse.bed[i].pumpCycles > 0 && greenhouse.bed[i].waterInterval > 0)
+			rate += greenhouse.bed[i].pumpedWater/greenhouse.bed[i].pumpCycles/greenhouse.bed[i].waterInterval;
+	}
+	if (rate <= 0)
+		return -1;
+	return tankRemaining(port)/rate;
+}
+
+/*
+Marks the sensor ports with a tank sensor
+*/
+void watchTanks(tGreenhouse& greenhouse)
+{
+	for (int port = 0; port < 4; port++)
+		tankWatched[port] = false;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		tankWatched[greenhouse.bed[i].fillSensor] = true;
+}
+
+/*
+Switches calibrated gauges to reflected light, fills the window of every tank sensor in use
+(so the first published level is already filtered) and starts the service
+*/
+void startWaterLevelService(tGreenhouse& greenhouse)
+{
+	watchTanks(greenhouse);
+	for (int port = 0; port < 4; port++)
+	{
+		tankHistory[port] = 0;
+		tankRawNext[port] = 0;
+		tankWater[port] = false;
+		tankLevel[port] = 0;
+		tankRefills[port] = 0;
+		tankEmpties[port] = 0;
+		tankRefillsSeen[port] = 0;
+		tankEmptiesSeen[port] = 0;
+		tankUsed[port] = 0;
+		tankCapacity[port] = TANK_CAPACITY;
+		if (tankWatched[port] && tankGauged[port])
+		{
+			SensorMode[(tSensors)port] = modeEV3Color_Reflected;
+			wait1Msec(50);
+		}
+	}
+	for (int i = 0; i < TANK_WINDOW; i++)
+	{
+		for (int port = 0; port < 4; port++)
+		{
+			if (tankWatched[port])
+				updateTank(port);
+		}
+		wait1Msec(TANK_SAMPLE_TIME);
+	}
+	startTask(waterLevelService);
+}
+
+bool checkFillLevel(tSensors fillSensor)
+{
+	return tankWater[fillSensor];
+}
+
+/*
+Waits (without busy polling the sensor) until the tank has water or the emergency stop is pressed
+*/
+void waitForWater(tSensors fillSensor)
+{
+	while (!tankWater[fillSensor] && (SensorValue[S3] == 0) && !emergencyStopped)
+	{
+		kickWatchdog(STALL_REFILL);
+		wait1Msec(TANK_SAMPLE_TIME);
+	}
+}
+
+void displayFillLevel(tSensors fillSensor)
+{
+	char text[DISPLAY_TEXT_SIZE];
+	if (checkFillLevel(fillSensor) && tankGauged[fillSensor])
+	{
+		sprintf(text, "Tank %d%% full.", tankLevel[fillSensor]);
+		showLine(5, text);
+	}
+	else if (checkFillLevel(fillSensor))
+		showLine(5, "Water available in tank.");
+	else
+	{
+		showLine(4, "Empty water tank.");
+		showLine(5, "Please add water.");
+	}
+}
+
+/*
+Returns the soil moisture of a bed in percent (0: as dry as moistureDry, 100: as wet as moistureWet)
+*/
+float moistureLevel(tBed& bed)
+{
+	if (bed.moistureWet == bed.moistureDry)
+		return bed.moistureTarget;
+	float level = 100.0*(SensorRaw[(tSensors)bed.moisturePort] - bed.moistureDry)/(bed.moistureWet - bed.moistureDry);
+	if (level < 0)
+		level = 0;
+	if (level > 100)
+		level = 100;
+	return level;
+}
+
+/*
+Scales a bed's water interval and dose to its demand, within the ADAPT_* limits
+The demand comes from the moisture sensor if the bed has one, otherwise from the time of day,
+and is cut while the tank is forecast to run dry within ADAPT_RESERVE_TIME
+The interval follows the demand first; the dose makes up what the interval limits leave
+*/
+void adaptWatering(tGreenhouse& greenhouse, tBed& bed)
+{
+	float demand = ADAPT_NIGHT_DEMAND;
+	long today = timeOfDay(time1[T1]);
+	if (bed.moisturePort >= 0)
+		demand = 1 + ADAPT_MOISTURE_GAIN*(bed.moistureTarget - moistureLevel(bed));
+	else if (today >= SUNRISE_TIME && today < SUNSET_TIME)
+		demand = ADAPT_DAY_DEMAND;
+	long emptyIn = tankTimeToEmpty(greenhouse, bed.fillSensor);
+	if (emptyIn >= 0 && emptyIn < ADAPT_RESERVE_TIME)
+		demand *= ADAPT_RESERVE_DEMAND;
+	if (demand < ADAPT_MIN_DEMAND)
+		demand = ADAPT_MIN_DEMAND;
+	if (demand > ADAPT_MAX_DEMAND)
+		demand = ADAPT_MAX_DEMAND;
+
+	float intervalScale = 1/demand;
+	if (intervalScale < ADAPT_MIN_INTERVAL)
+		intervalScale = ADAPT_MIN_INTERVAL;
+	if (intervalScale > ADAPT_MAX_INTERVAL)
+		intervalScale = ADAPT_MAX_INTERVAL;
+	int pumpSpeed = bed.basePumpSpeed*demand*intervalScale; //water per unit of time follows the demand
+	if (pumpSpeed < ADAPT_MIN_PUMP_SPEED)
+		pumpSpeed = ADAPT_MIN_PUMP_SPEED;
+	if (pumpSpeed > 100)
+		pumpSpeed = 100;
+
+	bed.waterInterval = bed.baseWaterInterval*intervalScale;
+	bed.pumpSpeed = pumpSpeed;
+	bed.demand = demand;
+}
+
+/*
+Adds the pumping since the last sample to the cell at a nozzle position (encoder counts from the start corner)
+*/
+void addCoverage(tBed& bed, long x, long y)
+{
+	long now = time1[T1];
+	int cellX = x*COVERAGE_X_CELLS/bed.calibration.xTravel;
+	int cellY = y*COVERAGE_Y_CELLS/bed.calibration.yTravel;
+	if (cellX < 0) cellX = 0;
+	if (cellX >= COVERAGE_X_CELLS) cellX = COVERAGE_X_CELLS - 1;
+	if (cellY < 0) cellY = 0;
+	if (cellY >= COVERAGE_Y_CELLS) cellY = COVERAGE_Y_CELLS - 1;
+	bed.coverage[cellX*COVERAGE_Y_CELLS + cellY] += now - bed.coverageClock;
+	bed.coverageClock = now;
+}
+
+/*
+Samples the nozzle position of a whole bed sweep (at most every COVERAGE_SAMPLE_TIME)
+yTravel: length of the y passes (the y encoder is reset at each end, return passes count back from it)
+*/
+void mapCoverage(tBed& bed, long yTravel)
+{
+	if (time1[T1] - bed.coverageClock < COVERAGE_SAMPLE_TIME)
+		return;
+	long x = abs(actuatorEncoder(bed.xAxis));
+	long y = abs(actuatorEncoder(bed.yAxis));
+	if (bed.yAxis.power < 0) //return pass
+		y = yTravel - y;
+	addCoverage(bed, x, y);
+}
+
+/*
+Finds the least and most watered cells of a bed, and the number of cells never watered
+*/
+void coverageSummary(tBed& bed, long& least, long& most, int& dryCells)
+{
+	least = bed.coverage[0];
+	most = bed.coverage[0];
+	dryCells = 0;
+	for (int i = 0; i < COVERAGE_CELLS; i++)
+	{
+		if (bed.coverage[i] < least)
+			least = bed.coverage[i];
+		if (bed.coverage[i] > most)
+			most = bed.coverage[i];
+		if (bed.coverage[i] == 0)
+			dryCells++;
+	}
+}
+
+/*
+Waits for water in the bed's tank, prompting the user to fill it
+Returns false if the emergency stop is pressed while waiting
+*/
+bool waitForTank(tBed& bed)
+{
+	if (!checkFillLevel(bed.fillSensor)) //no water
+	{
+		displayFillLevel(bed.fillSensor); //prompts user until water is filled
+		waitForWater(bed.fillSensor);
+		if (SensorValue[S3] == 1 || emergencyStopped) //emergency button pressed while waiting
+			return false;
+	}
+	return true;
+}
+
+//Starts pump and returns time of start
+float startPump(tBed& bed)
+{
+	float startTime = time1[T1];
+	driveActuator(bed.pump, bed.pumpSpeed);
+	return startTime;
+}
+
+/*
+Resets x-axis to starting position
+Returns false if fails
+taskFailed updates to AXIS_FAILED (3) or NO_FAILURE (0)
+*/
+bool resetWaterCycle(tBed& bed, int& taskFailed)
+{
+	bool executed = true; //assume no failure
+	float startTime = time1[T1];
+	long xReturn = bed.calibration.xReturn - bed.calibration.xTravel*(1.0 - bed.xSpan); //only the swept part
+	resetActuatorEncoder(bed.xAxis2); //error when combined in one line
+	resetActuatorEncoder(bed.xAxis);
+	
+	driveActuator(bed.xAxis2, -X_AXIS_SPEED); //x-axis motors
+	driveActuator(bed.xAxis, -X_AXIS_SPEED);
+	long count = 0;
+	while((abs(count) < xReturn)
+		&& (time1[T1] - startTime < bed.calibration.maxXTime) && !emergencyStopped)
+	{
+		kickOnProgress(STALL_RESET, count);
+		count = actuatorEncoder(bed.xAxis);
+	}
+	driveActuator(bed.xAxis2, 0);
+	driveActuator(bed.xAxis, 0);
+	
+	if (time1[T1] - startTime > bed.calibration.maxXTime) //exceeded timer
+	{
+		taskFailed = AXIS_FAILED;
+		executed = false;
+	}
+	else if (SensorValue[S3] == 1 || emergencyStopped) //emergency stop button
+	{
+		executed = false;
+	}
+	return executed;
+}
+
+/*
+Returns the side of the plant facing the light at an orientation (0-3)
+*/
+int faceOf(int orientation)
+{
+	return (orientation + 4) % 4;
+}
+
+/*
+Counts the daylight since the last update against the side facing the light
+Nothing is counted while the orientation is unknown (no side is known to face the light)
+*/
+void updateExposure(tBed& bed)
+{
+	long now = wallClock();
+	if (bed.orientation != ORIENTATION_UNKNOWN)
+		bed.faceExposure[faceOf(bed.orientation)] += daylightBetween(bed.exposureClock, now);
+	bed.exposureClock = now;
+}
+
+/*
+Returns the orientation that faces the least lit side towards the light (the fewest turns away of equals)
+Returns the current orientation if no side has had EXPOSURE_BALANCE less light than the one facing it
+*/
+int leastLitOrientation(tBed& bed)
+{
+	int best = bed.orientation;
+	long bestExposure = bed.faceExposure[faceOf(bed.orientation)] - EXPOSURE_BALANCE; //a turn must gain at least this
+	for (int orientation = MIN_ORIENTATION; orientation <= MAX_ORIENTATION; orientation++)
+	{
+		long exposure = bed.faceExposure[faceOf(orientation)];
+		if (exposure < bestExposure || (exposure == bestExposure && best != bed.orientation
+			&& abs(orientation - bed.orientation) < abs(best - bed.orientation)))
+		{
+			best = orientation;
+			bestExposure = exposure;
+		}
+	}
+	return best;
+}
+
+/*
+Powers the motors to turn the least lit side towards the light (at ROTATION_SPEED), 90 degrees per quarter turn
+Stays put while the light is balanced (see leastLitOrientation), or while the orientation is unknown
+bed.orientation: quarter turns from the start, kept within MIN_ORIENTATION to MAX_ORIENTATION;
+ORIENTATION_UNKNOWN after a turn that timed out or was emergency stopped part way
+bed.clockwise: true for CW, false for CCW
+Returns false if fails
+taskFailed updates to ROTATION_FAILED (1) or NO_FAILURE (0)
+*/
+bool rotateGreenhouse(tBed& bed, int& taskFailed)
+{
+	bool executed = true;
+	updateExposure(bed);
+	if (bed.orientation == ORIENTATION_UNKNOWN) //turning on could wind the cable up
+		return true;
+	int target = leastLitOrientation(bed);
+	if (target == bed.orientation) //balanced, no turn needed
+		return true;
+	int quarters = abs(target - bed.orientation);
+	bed.clockwise = (target > bed.orientation);
+	float startTime = time1[T1];
+	
+	if (bed.clockwise)
+		driveActuator(bed.rotation, -ROTATION_SPEED); //CW
+	else
+		driveActuator(bed.rotation, ROTATION_SPEED); //CCW
+	
+	resetActuatorEncoder(bed.rotation);
+	long count = 0;
+	while((abs(count) < quarters*bed.calibration.rotationTravel)
+		&& (time1[T1] - startTime < quarters*bed.calibration.maxRotationTime) && !emergencyStopped) //fail-safe
+	{
+		kickOnProgress(STALL_ROTATE, count);
+		count = actuatorEncoder(bed.rotation);
+	}
+	driveActuator(bed.rotation, 0);
+	
+	if (time1[T1] - startTime > quarters*bed.calibration.maxRotationTime) //exceeded timer
+	{
+		taskFailed = ROTATION_FAILED;
+		executed = false;
+		bed.orientation = ORIENTATION_UNKNOWN; //stopped part way
+	}
+	else if (emergencyStopped)
+	{
+		executed = false;
+		bed.orientation = ORIENTATION_UNKNOWN;
+	}
+	else
+	{
+		bed.orientation = target;
+		bed.turnCycles++;
+	}
+	return executed;
+}
+
+/*
+Checks if water is available
+Starts the pump and the 2D axis motors
+Stops pump
+Returns false if fails
+taskFailed updates as AXIS_FAILED (3), PUMP_FAILED (2), or NO_FAILURE (0)
+*/
+bool activateWaterCycle(tBed& bed, int& taskFailed)
+{
+	bool executed = true;
+	if (!waitForTank(bed))
+		return false;
+	long xTravel = bed.calibration.xTravel*bed.xSpan; //coverage
+	long yTravel = bed.calibration.yTravel*bed.ySpan;
+	float startTime = time1[T1]; // fail safe timer
+	clearScreen();
+	startPump(bed);
+	bed.coverageClock = time1[T1];
+
+	//activate 2D axis (error caused when combined in one line)
+	resetActuatorEncoder(bed.xAxis);
+	resetActuatorEncoder(bed.xAxis2);
+	resetActuatorEncoder(bed.yAxis);
+	driveActuator(bed.xAxis2, X_AXIS_SPEED);
+	driveActuator(bed.xAxis, X_AXIS_SPEED);
+	driveActuator(bed.yAxis, Y_AXIS_SPEED);
+	
+	float xStartTime = time1[T1]; //fail safe
+	long xCount = 0;
+	while((abs(xCount) < xTravel)
+		&& (time1[T1] - xStartTime < bed.calibration.maxXTime) && (time1[T1] - startTime < bed.calibration.maxPumpTime)
+		&& (SensorValue[S3] == 0) && !emergencyStopped)
+	{
+		// y-axis iterates multiple times while x-axis makes its first iteration
+		float yStartTime = time1[T1];
+		long yCount = 0;
+		while((abs(yCount) < yTravel)
+			&& (time1[T1] - yStartTime < bed.calibration.maxYTime) && !emergencyStopped)
+		{
+			kickOnProgress(STALL_Y_AXIS, yCount);
+			mapCoverage(bed, yTravel);
+			yCount = actuatorEncoder(bed.yAxis);
+		}
+		driveActuator(bed.yAxis, -bed.yAxis.power); //change y-axis direction
+		resetActuatorEncoder(bed.yAxis);
+		if (time1[T1] - yStartTime > bed.calibration.maxYTime) //exceeded y-axis timer
+		{
+			taskFailed = AXIS_FAILED;
+			executed = false;
+		}
+		xCount = actuatorEncoder(bed.xAxis);
+		kickOnProgress(STALL_WATER, xCount);
+	}
+	if (SensorValue[S3] == 1 || emergencyStopped) //emergency button pressed
+		{
+			executed = false;
+		}
+	mapCoverage(bed, yTravel);
+	driveActuator(bed.yAxis, 0); //stop axis
+	driveActuator(bed.xAxis, 0);
+	driveActuator(bed.xAxis2, 0);
+	driveActuator(bed.pump, 0); //stop pump
+	recordDose(bed, time1[T1] - startTime, bed.pumpSpeed);
+	bed.pumpCycles++;
+	
+	if (time1[T1] - xStartTime > bed.calibration.maxXTime) //exceeded x-axis timer
+	{
+		taskFailed = AXIS_FAILED;
+		executed = false;
+	}
+	else if (time1[T1] - startTime > bed.calibration.maxPumpTime) //exceeded pump timer
+	{
+		taskFailed = PUMP_FAILED;
+		executed = false;
+	}
+	
+	return executed;
+}
+
+/*
+Zones to water in one cycle, in the order of visiting
+*/
+typedef struct
+{
+	int numZones;
+	int zone[MAX_ZONES];
+} tZonePlan;
+
+/*
+Returns an encoder count limited to the calibrated travel of an axis (0 to travel)
+*/
+long travelCount(long count, long travel)
+{
+	if (count < 0)
+		return 0;
+	if (count > travel)
+		return travel;
+	return count;
+}
+
+/*
+Returns the time (ms) to move the nozzle between two positions, both axes moving at once
+*/
+long zoneTravelTime(tBed& bed, long fromX, long fromY, long toX, long toY)
+{
+	long xTime = abs(toX - fromX)*bed.calibration.maxXTime/bed.calibration.xTravel;
+	long yTime = abs(toY - fromY)*bed.calibration.maxYTime/bed.calibration.yTravel;
+	return (xTime > yTime) ? xTime : yTime;
+}
+
+/*
+Returns the travel time of visiting the zones in a plan's order, from the start corner and back
+(each zone is entered at its first corner and left at the middle of its far side)
+*/
+long planTravelTime(tBed& bed, tZonePlan& plan)
+{
+	long x = 0;
+	long y = 0;
+	long travel = 0;
+	for (int i = 0; i < plan.numZones; i++)
+	{
+		int zone = plan.zone[i];
+		long yStart = travelCount(bed.zoneY1[zone], bed.calibration.yTravel);
+		travel += zoneTravelTime(bed, x, y, travelCount(bed.zoneX1[zone], bed.calibration.xTravel), yStart);
+		x = travelCount(bed.zoneX2[zone], bed.calibration.xTravel);
+		y = (yStart + travelCount(bed.zoneY2[zone], bed.calibration.yTravel))/2;
+	}
+	return travel + zoneTravelTime(bed, x, y, 0, 0);
+}
+
+/*
+Plans the zones due for water (every zone if everyZone), in the order with the least travel time
+Every order is tried (at most MAX_ZONES! = 24, Heap's algorithm)
+*/
+void planZones(tBed& bed, bool everyZone, tZonePlan& plan)
+{
+	tZonePlan order;
+	int swaps[MAX_ZONES];
+	order.numZones = 0;
+	for (int zone = 0; zone < bed.numZones; zone++)
+	{
+		if (everyZone || time1[T1] - bed.zoneLastWater[zone] >= bed.zoneInterval[zone] - WHEEL_TICK)
+		{
+			order.zone[order.numZones] = zone;
+			swaps[order.numZones] = 0;
+			order.numZones++;
+		}
+	}
+	memcpy(plan, order, sizeof(tZonePlan));
+	long best = planTravelTime(bed, order);
+	int i = 1;
+	while (i < order.numZones)
+	{
+		if (swaps[i] < i)
+		{
+			int other = (i % 2 == 0) ? 0 : swaps[i];
+			int zone = order.zone[other];
+			order.zone[other] = order.zone[i];
+			order.zone[i] = zone;
+			long travel = planTravelTime(bed, order);
+			if (travel < best)
+			{
+				best = travel;
+				memcpy(plan, order, sizeof(tZonePlan));
+			}
+			swaps[i]++;
+			i = 1;
+		}
+		else
+		{
+			swaps[i] = 0;
+			i++;
+		}
+	}
+}
+
+/*
+Drives the nozzle to a position (encoder counts from the start corner), both axes at once
+Returns false if fails
+taskFailed updates to AXIS_FAILED (3) or NO_FAILURE (0)
+*/
+bool moveNozzle(tBed& bed, long x, long y, int& taskFailed)
+{
+	bool executed = true;
+	float startTime = time1[T1];
+	int xDirection = (x > actuatorEncoder(bed.xAxis)) ? 1 : -1;
+	int yDirection = (y > actuatorEncoder(bed.yAxis)) ? 1 : -1;
+	bool xMoving = abs(x - actuatorEncoder(bed.xAxis)) > ZONE_POSITION_TOLERANCE;
+	bool yMoving = abs(y - actuatorEncoder(bed.yAxis)) > ZONE_POSITION_TOLERANCE;
+	if (xMoving)
+	{
+		driveActuator(bed.xAxis2, xDirection*X_AXIS_SPEED);
+		driveActuator(bed.xAxis, xDirection*X_AXIS_SPEED);
+	}
+	if (yMoving)
+		driveActuator(bed.yAxis, yDirection*Y_AXIS_SPEED);
+	while ((xMoving || yMoving) && (time1[T1] - startTime < bed.calibration.maxXTime) && !emergencyStopped)
+	{
+		long xCount = actuatorEncoder(bed.xAxis);
+		long yCount = actuatorEncoder(bed.yAxis);
+		kickOnProgress(STALL_ZONE, xMoving ? xCount : yCount);
+		if (xMoving && (xCount - x)*xDirection >= 0)
+		{
+			driveActuator(bed.xAxis2, 0);
+			driveActuator(bed.xAxis, 0);
+			xMoving = false;
+		}
+		if (yMoving && (yCount - y)*yDirection >= 0)
+		{
+			driveActuator(bed.yAxis, 0);
+			yMoving = false;
+		}
+	}
+	driveActuator(bed.yAxis, 0);
+	driveActuator(bed.xAxis2, 0);
+	driveActuator(bed.xAxis, 0);
+
+	if (time1[T1] - startTime > bed.calibration.maxXTime) //exceeded timer
+	{
+		taskFailed = AXIS_FAILED;
+		executed = false;
+	}
+	else if (emergencyStopped)
+		executed = false;
+	return executed;
+}
+
+/*
+Waters one zone: the nozzle sweeps y across the zone while x crosses it, with the pump at the zone's dose
+Returns false if fails
+taskFailed updates as AXIS_FAILED (3), PUMP_FAILED (2), or NO_FAILURE (0)
+*/
+bool waterZone(tBed& bed, int zone, int& taskFailed)
+{
+	bool executed = true;
+	long xStart = travelCount(bed.zoneX1[zone], bed.calibration.xTravel);
+	long xEnd = travelCount(bed.zoneX2[zone], bed.calibration.xTravel);
+	long yStart = travelCount(bed.zoneY1[zone], bed.calibration.yTravel);
+	long yEnd = travelCount(bed.zoneY2[zone], bed.calibration.yTravel);
+	if (xStart >= xEnd || yStart >= yEnd) //zone outside the calibrated travel
+		return true;
+	if (!moveNozzle(bed, xStart, yStart, taskFailed))
+		return false;
+
+	float startTime = time1[T1]; //fail safe
+	int power = (bed.zonePumpSpeed[zone] > 0) ? bed.zonePumpSpeed[zone] : bed.pumpSpeed;
+	driveActuator(bed.pump, power);
+	bed.coverageClock = time1[T1];
+	driveActuator(bed.xAxis2, X_AXIS_SPEED);
+	driveActuator(bed.xAxis, X_AXIS_SPEED);
+	driveActuator(bed.yAxis, Y_AXIS_SPEED);
+	long x = actuatorEncoder(bed.xAxis);
+	while ((x < xEnd) && (time1[T1] - startTime < bed.calibration.maxPumpTime)
+		&& (SensorValue[S3] == 0) && !emergencyStopped)
+	{
+		kickOnProgress(STALL_ZONE, x); //x crosses the zone without reversing
+		long y = actuatorEncoder(bed.yAxis);
+		if ((bed.yAxis.power > 0 && y >= yEnd) || (bed.yAxis.power < 0 && y <= yStart))
+			driveActuator(bed.yAxis, -bed.yAxis.power); //change y-axis direction
+		addCoverage(bed, x, y);
+		x = actuatorEncoder(bed.xAxis);
+	}
+	driveActuator(bed.yAxis, 0); //stop axis
+	driveActuator(bed.xAxis, 0);
+	driveActuator(bed.xAxis2, 0);
+	driveActuator(bed.pump, 0); //stop pump
+	recordDose(bed, time1[T1] - startTime, power);
+	bed.zoneLastWater[zone] = time1[T1];
+
+	if (time1[T1] - startTime > bed.calibration.maxPumpTime) //exceeded pump timer
+	{
+		taskFailed = PUMP_FAILED;
+		executed = false;
+	}
+	else if (SensorValue[S3] == 1 || emergencyStopped) //emergency button pressed
+		executed = false;
+	return executed;
+}
+
+/*
+Waters the zones of a bed that are due (every zone if everyZone) in the planned order,
+then returns the nozzle to the start corner
+Returns false if fails
+taskFailed updates as AXIS_FAILED (3), PUMP_FAILED (2), or NO_FAILURE (0)
+*/
+bool waterZones(tBed& bed, bool everyZone, int& taskFailed)
+{
+	tZonePlan plan;
+	planZones(bed, everyZone, plan);
+	if (plan.numZones == 0)
+		return true;
+	if (!waitForTank(bed))
+		return false;
+	clearScreen();
+	bed.waterCycles++;
+	bed.pumpCycles++; //one cycle however many zones it waters
+	resetActuatorEncoder(bed.xAxis); //the nozzle starts each cycle at the start corner
+	resetActuatorEncoder(bed.xAxis2);
+	resetActuatorEncoder(bed.yAxis);
+	bool executed = true;
+	for (int i = 0; i < plan.numZones && executed; i++)
+		executed = waterZone(bed, plan.zone[i], taskFailed);
+	if (executed) //x overshoots the start by the buffer, as in resetWaterCycle
+		executed = moveNozzle(bed, bed.calibration.xTravel - bed.calibration.xReturn, 0, taskFailed);
+	return executed;
+}
+
+/*
+Runs a water cycle on a bed: its due zones if it has any, otherwise a sweep of the whole bed
+Returns false if fails
+*/
+bool waterBed(tBed& bed, bool everyZone, int& taskFailed)
+{
+	if (bed.numZones > 0)
+		return waterZones(bed, everyZone, taskFailed);
+	if (!activateWaterCycle(bed, taskFailed))
+		return false;
+	bed.waterCycles++;
+	return resetWaterCycle(bed, taskFailed);
+}
+
+/*
+Waits for any button to be pressed
+Returns false if none is pressed for timeout ms first (0: waits as long as it takes)
+*/
+bool waitButtonPress(long timeout)
+{
+	long start = time1[T1];
+	while(!getButtonPress(buttonAny))
+	{
+		if (timeout > 0 && time1[T1] - start > timeout)
+			return false;
+	}
+	return true;
+}
+
+/*
+Prompts the user to enter the current time and saves to float variables
+Returns false if no button is pressed for timeout ms (0: no timeout); the time is then not entered
+*/
+bool setStartTime(float& hour, float& minute, float& period, long timeout)
+{
+	char text[DISPLAY_TEXT_SIZE];
+
+	// prompt user
+	showLine(3, "Please enter the current time:");
+	waitMessage();
+	showLine(3, "Use up/down arrows change #s");
+	showLine(4, "Use enter to go next");
+	waitMessage();
+	showLine(3, "Please enter the current time:");
+
+	// generate time as user changes it
+	int timeSet = 0;
+	/*
+		setTime = 0; Change hours
+		setTime = 1; Change minutes
+		setTime = 2; Change period (a.m./p.m.)
+	*/
+	
+	string periodDisplay = "a.m.";
+	
+	while (timeSet != 2)
+	{
+		// generate updated time after toggling
+		if (minute< 10) sprintf(text, "%d:0%d %s", hour, minute, periodDisplay);
+		else sprintf(text, "%d:%d %s", hour, minute, periodDisplay);
+		showLine(4, text);
+
+		// toggle settings
+		if (!waitButtonPress(timeout))
+		{
+			clearScreen();
+			return false;
+		}
+		if (getButtonPress(buttonDown))
+		{
+			if (timeSet == 0 && hour>1) hour--;
+			else if (timeSet == 1 && minute>0) minute--;
+		}
+		else if (getButtonPress(buttonUp))
+		{
+			if (timeSet == 0 && hour < 12) hour++;
+			else if (timeSet == 1 && minute < 59) minute++;
+		}
+		else if (getButtonPress(buttonEnter))timeSet++;
+		wait1Msec(500);
+	}
+
+	while (timeSet == 2)
+	{
+		if (!waitButtonPress(timeout))
+		{
+			clearScreen();
+			return false;
+		}
+		if (getButtonPress(buttonUp) || getButtonPress(buttonDown))
+		{
+			if (period == 0) period = 1;
+			else period = 0;
+		}
+
+		string periodDisplay = " ";
+		if (period == 0) periodDisplay = "a.m.";
+		else periodDisplay = "p.m.";
+		// generate updated time after toggling
+		if (minute< 10) sprintf(text, "%d:0%d %s", hour, minute, periodDisplay);
+		else sprintf(text, "%d:%d %s", hour, minute, periodDisplay);
+		showLine(4, text);
+
+		if (getButtonPress(buttonEnter)) timeSet = 3;
+
+		wait1Msec(500);
+	}
+	clearScreen();
+	return true;
+}
+
+/*
+Reads one line of a text file into line (without the line ending, cut to CONFIG_LINE_SIZE)
+Returns the length of the line, or -1 at end of file
+*/
+int readConfigLine(long fileHandle, char* line)
+{
+	char ch = 0;
+	int length = 0;
+	bool readAny = false;
+	while (fileReadData(fileHandle, &ch, 1) && ch != '\n')
+	{
+		readAny = true;
+		if (ch != '\r' && length < CONFIG_LINE_SIZE)
+		{
+			line[length] = ch;
+			length++;
+		}
+	}
+	if (!readAny && ch != '\n')
+		return -1;
+	return length;
+}
+
+/*
+Reads a motor setting: A-D for a brick motor, S<port 1-4>_<channel 1-2> (e.g. S2_1) for a multiplexer
+channel, - for none
+Returns false if fails (any other setting; the actuator is left disconnected)
+*/
+bool parseActuator(tTokenCursor& cursor, tToken& token, tActuator& actuator)
+{
+	char first = cursor.buffer[token.start];
+	disconnectActuator(actuator);
+	if (token.length == 1 && first == '-')
+		return true;
+	if (token.length == 1 && first >= 'A' && first <= 'D')
+	{
+		setBrickActuator(actuator, (tMotor)(motorA + (first - 'A')));
+		return true;
+	}
+	if (token.length != 4 || first != 'S' || cursor.buffer[token.start + 2] != '_')
+		return false;
+	int port = cursor.buffer[token.start + 1] - '1';
+	int channel = cursor.buffer[token.start + 3] - '1';
+	//the multiplexer drives only two channels
+	if (port < 0 || port > 3 || channel < 0 || channel > 1)
+		return false;
+	setMuxActuator(actuator, (tMUXmotor)(port*4 + channel));
+	return true;
+}
+
+/*
+Reads a time of day (H:MM or HH:MM, 24 hour clock) into dayTime, in ms after midnight
+Returns false if fails (anything else, or an hour past 23 or a minute past 59)
+*/
+bool parseClockTime(tTokenCursor& cursor, tToken& token, long& dayTime)
+{
+	int colon = token.length - 3; //two minute digits after it
+	if (colon < 1 || colon > 2 || cursor.buffer[token.start + colon] != ':')
+		return false;
+	long hour = 0;
+	long minute = 0;
+	for (int i = 0; i < token.length; i++)
+	{
+		char ch = cursor.buffer[token.start + i];
+		if (i == colon)
+			continue;
+		if (ch < '0' || ch > '9')
+			return false;
+		if (i < colon)
+			hour = hour*10 + (ch - '0');
+		else
+			minute = minute*10 + (ch - '0');
+	}
+	if (hour > 23 || minute > 59)
+		return false;
+	dayTime = (hour*60 + minute)*60000;
+	return true;
+}
+
+/*
+Reads the times of a water at or rotation at setting (see loadConfig)
+Returns false if fails (a malformed time; the rules of that kind are left as they were)
+*/
+bool parseClockTimes(tTokenCursor& cursor, tClockRules& rules, int kind)
+{
+	tToken token;
+	long times[MAX_CLOCK_TIMES];
+	int numTimes = 0;
+	while (numTimes < MAX_CLOCK_TIMES && tokenNext(cursor, token, ' '))
+	{
+		if (!parseClockTime(cursor, token, times[numTimes]))
+			return false;
+		numTimes++;
+	}
+	for (int i = 0; i < numTimes; i++)
+		rules.times[kind*MAX_CLOCK_TIMES + i] = times[i];
+	rules.numTimes[kind] = numTimes;
+	return true;
+}
+
+/*
+Reads a quiet setting after its key (see loadConfig): the job kind, then the start and end times
+(the end defaults to the start)
+Returns false if fails (a kind other than water or rotation, or a missing or malformed time)
+*/
+bool parseQuiet(tTokenCursor& cursor, tClockRules& rules)
+{
+	tToken token;
+	int kind = -1;
+	long start = 0;
+	if (!tokenNext(cursor, token, ' '))
+		return false;
+	if (tokenEquals(cursor, token, "water"))
+		kind = JOB_WATER;
+	else if (tokenEquals(cursor, token, "rotation"))
+		kind = JOB_ROTATE;
+	else
+		return false;
+	if (!tokenNext(cursor, token, ' ') || !parseClockTime(cursor, token, start))
+		return false;
+	long end = start;
+	if (tokenNext(cursor, token, ' ') && !parseClockTime(cursor, token, end))
+		return false;
+	rules.quietStart[kind] = start;
+	rules.quietEnd[kind] = end;
+	rules.quiet[kind] = true;
+	return true;
+}
+
+/*
+Adds a zone to a bed from a zone setting (see loadConfig)
+Zones without an area or a positive interval are ignored; the rectangle is limited to the
+calibrated travel when watered (see waterZone)
+*/
+void parseZone(tTokenCursor& cursor, tBed& bed)
+{
+	tToken token;
+	long values[5];
+	for (int i = 0; i < 5; i++)
+	{
+		values[i] = 0;
+		if (tokenNext(cursor, token, ' ')) values[i] = tokenToLong(cursor, token);
+	}
+	if (values[0] < 0 || values[1] < 0 || values[2] < 0 || values[3] < 0
+		|| values[0] == values[1] || values[2] == values[3] || values[4] <= 0)
+		return;
+	int zone = bed.numZones;
+	bed.zoneX1[zone] = (values[0] < values[1]) ? values[0] : values[1];
+	bed.zoneX2[zone] = (values[0] < values[1]) ? values[1] : values[0];
+	bed.zoneY1[zone] = (values[2] < values[3]) ? values[2] : values[3];
+	bed.zoneY2[zone] = (values[2] < values[3]) ? values[3] : values[2];
+	bed.zoneInterval[zone] = values[4];
+	bed.zonePumpSpeed[zone] = 0;
+	if (tokenNext(cursor, token, ' ')) bed.zonePumpSpeed[zone] = tokenToLong(cursor, token);
+	if (bed.zonePumpSpeed[zone] < 0 || bed.zonePumpSpeed[zone] > 100)
+		bed.zonePumpSpeed[zone] = 0; //the bed's
+	bed.numZones++;
+}
+
+/*
+Reads a bed setting (see loadConfig) into bed
+Returns false if fails (a motor or the tank sensor port is not valid wiring, the bed must not be added)
+*/
+bool parseBed(tTokenCursor& cursor, tBed& bed)
+{
+	tToken token;
+	char name[CONFIG_NAME_SIZE];
+	resetBedState(bed);
+	bed.waterInterval = 0;
+	bed.rotationInterval = 0;
+	setFullCoverage(bed);
+	bed.adaptive = false;
+	bed.demand = 1;
+	bed.moisturePort = -1;
+	bed.numZones = 0;
+	bed.fillSensor = S4;
+	bed.rotationPid.tuned = false;
+	defaultCalibration(bed.calibration);
+	bed.name = " ";
+	if (tokenNext(cursor, token, ' '))
+	{
+		tokenCopy(cursor, token, name, CONFIG_NAME_SIZE);
+		stringFromChars(bed.name, name);
+	}
+	disconnectActuator(bed.rotation);
+	disconnectActuator(bed.xAxis);
+	disconnectActuator(bed.xAxis2);
+	disconnectActuator(bed.yAxis);
+	disconnectActuator(bed.pump);
+	if (tokenNext(cursor, token, ' ') && !parseActuator(cursor, token, bed.rotation)) return false;
+	if (tokenNext(cursor, token, ' ') && !parseActuator(cursor, token, bed.xAxis)) return false;
+	if (tokenNext(cursor, token, ' ') && !parseActuator(cursor, token, bed.xAxis2)) return false;
+	if (tokenNext(cursor, token, ' ') && !parseActuator(cursor, token, bed.yAxis)) return false;
+	if (tokenNext(cursor, token, ' ') && !parseActuator(cursor, token, bed.pump)) return false;
+	if (tokenNext(cursor, token, ' '))
+	{
+		long port = tokenToLong(cursor, token);
+		if (port < 1 || port > 4)
+			return false;
+		bed.fillSensor = (tSensors)(port - 1);
+	}
+	if (tokenNext(cursor, token, ' ')) bed.waterInterval = tokenToFloat(cursor, token);
+	if (tokenNext(cursor, token, ' ')) bed.rotationInterval = tokenToFloat(cursor, token);
+	return true;
+}
+
+bool actuatorOnPort(tActuator& actuator, int port)
+{
+	return actuator.connected && actuator.onMux && SPORT(actuator.muxPort) == port;
+}
+
+bool bedMuxOnPort(tBed& bed, int port)
+{
+	return actuatorOnPort(bed.rotation, port) || actuatorOnPort(bed.xAxis, port) || actuatorOnPort(bed.xAxis2, port)
+		|| actuatorOnPort(bed.yAxis, port) || actuatorOnPort(bed.pump, port);
+}
+
+/*
+Returns true if sensor port (0-3) has a multiplexer: the one on S1, or one driving a motor of any bed
+*/
+bool muxOnPort(tGreenhouse& greenhouse, int port)
+{
+	if (port == (int)S1)
+		return true;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (bedMuxOnPort(greenhouse.bed[i], port))
+			return true;
+	}
+	return false;
+}
+
+/*
+Returns true if sensor port (0-3) has a sensor: the S3 touch sensor, or the tank or moisture sensor of any bed
+*/
+bool sensorOnPort(tGreenhouse& greenhouse, int port)
+{
+	if (port == (int)S3)
+		return true;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if ((int)greenhouse.bed[i].fillSensor == port || greenhouse.bed[i].moisturePort == port)
+			return true;
+	}
+	return false;
+}
+
+/*
+Returns true if sensor port (0-3) is already wired to a sensor or a multiplexer
+*/
+bool sensorPortInUse(tGreenhouse& greenhouse, int port)
+{
+	return sensorOnPort(greenhouse, port) || muxOnPort(greenhouse, port);
+}
+
+bool sameMotor(tActuator& actuator, tActuator& other)
+{
+	if (!actuator.connected || !other.connected || actuator.onMux != other.onMux)
+		return false;
+	if (actuator.onMux)
+		return actuator.muxPort == other.muxPort;
+	return actuator.port == other.port;
+}
+
+/*
+Returns how many of the bed's motors are the actuator's brick motor or multiplexer channel
+*/
+int motorUses(tActuator& actuator, tBed& bed)
+{
+	int uses = 0;
+	if (sameMotor(actuator, bed.rotation)) uses++;
+	if (sameMotor(actuator, bed.xAxis)) uses++;
+	if (sameMotor(actuator, bed.xAxis2)) uses++;
+	if (sameMotor(actuator, bed.yAxis)) uses++;
+	if (sameMotor(actuator, bed.pump)) uses++;
+	return uses;
+}
+
+/*
+Returns true if a motor of a new bed is already driven (by the bed itself or any other bed), or is a
+multiplexer channel on a port wired to a sensor
+*/
+bool motorInUse(tGreenhouse& greenhouse, tBed& bed, tActuator& actuator)
+{
+	if (!actuator.connected)
+		return false;
+	if (motorUses(actuator, bed) > 1)
+		return true;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (motorUses(actuator, greenhouse.bed[i]) > 0)
+			return true;
+	}
+	return actuator.onMux && (sensorOnPort(greenhouse, SPORT(actuator.muxPort))
+		|| SPORT(actuator.muxPort) == (int)bed.fillSensor);
+}
+
+/*
+Returns true if a new bed's wiring clashes with the greenhouse's (a motor or sensor port already in use)
+Beds may share a tank sensor, and multiplexers as long as each channel drives one motor
+*/
+bool bedWiringClashes(tGreenhouse& greenhouse, tBed& bed)
+{
+	if (motorInUse(greenhouse, bed, bed.rotation) || motorInUse(greenhouse, bed, bed.xAxis)
+		|| motorInUse(greenhouse, bed, bed.xAxis2) || motorInUse(greenhouse, bed, bed.yAxis)
+		|| motorInUse(greenhouse, bed, bed.pump))
+		return true;
+	int tankPort = (int)bed.fillSensor;
+	if (tankPort == (int)S3 || muxOnPort(greenhouse, tankPort) || bedMuxOnPort(bed, tankPort))
+		return true;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (greenhouse.bed[i].moisturePort == tankPort)
+			return true;
+	}
+	return false;
+}
+
+/*
+Reads the user settings from CONFIG_FILE, one setting per line ('#' starts a comment):
+	name <plant name>
+	water <ms between water cycles>
+	rotation <ms between rotation cycles>
+	water at <HH:MM> [HH:MM ...]	(water at these times of day instead, up to MAX_CLOCK_TIMES)
+	rotation at <HH:MM> [HH:MM ...]
+	quiet <water/rotation> <HH:MM> <HH:MM>	(no cycles from the first time to the second)
+		(times are 24 hour H:MM or HH:MM; a setting with any other time or kind is ignored)
+	adapt	(every bed's water interval and dose follow its demand, see adaptWatering)
+	moisture <bed 1-4> <sensor port 1-4> <dry raw> <wet raw> <target %>
+		(soil moisture sensor of a bed, after its bed setting; the bed adapts to it; ignored if the
+		port is already wired to another sensor or a multiplexer)
+	zone <bed 1-4> <x from> <x to> <y from> <y to> <water ms> [pump power]
+		(a rectangle in encoder counts from the start corner, after the bed setting; a bed with
+		zones waters only those that are due, up to MAX_ZONES)
+	date <day> <month> <year>
+	time <hour> <minute> <am/pm>	(start time of a new schedule; a resumed one keeps its saved clock)
+	profile <profile name> <water ms> <rotation ms>
+	plant <profile name>	(uses that profile's intervals, and its name unless name is given;
+		without such a profile, the built-in preset of that name: succulent, fern, herb or flower)
+	bed <name> <rotation> <x axis> <second x axis> <y axis> <pump> <tank sensor port 1-4> [water ms] [rotation ms]
+		(adds another bed; motors are A-D or multiplexer channels S<port 1-4>_<channel 1-2>, - for none;
+		a bed with any other wiring, or with a motor or sensor port another bed or sensor already uses,
+		is skipped; beds may share a tank sensor)
+Settings not in the file keep their current values
+plantPreset updates to the preset chosen by a plant setting
+Returns true if the current time was given (no need to prompt for it)
+*/
+bool loadConfig(string& plantName, float& waterTiming, float& rotationTiming, float& day, float& month,
+float& year, float& hour, float& minute, float& period, int& plantPreset, tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenRead(CONFIG_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	char line[CONFIG_LINE_SIZE];
+	char name[CONFIG_NAME_SIZE];
+	char profileNames[MAX_PROFILES][CONFIG_NAME_SIZE];
+	float profileWater[MAX_PROFILES];
+	float profileRotation[MAX_PROFILES];
+	char plantProfile[CONFIG_NAME_SIZE];
+	int numProfiles = 0;
+	bool nameGiven = false;
+	bool timeGiven = false;
+	bool adaptAll = false;
+	plantProfile[0] = 0;
+
+	tTokenCursor cursor;
+	tToken key;
+	tToken token;
+	int length = readConfigLine(fileHandle, line);
+	while (length >= 0)
+	{
+		tokenInit(cursor, line, length);
+		if (tokenNext(cursor, key, ' ') && line[key.start] != '#')
+		{
+			if (tokenEquals(cursor, key, "name") && tokenNext(cursor, token, ' '))
+			{
+				tokenCopy(cursor, token, name, CONFIG_NAME_SIZE);
+				stringFromChars(plantName, name);
+				nameGiven = true;
+			}
+			else if (tokenEquals(cursor, key, "water") && tokenNext(cursor, token, ' '))
+			{
+				if (tokenEquals(cursor, token, "at"))
+					parseClockTimes(cursor, greenhouse.rules, JOB_WATER);
+				else
+					waterTiming = tokenToFloat(cursor, token);
+			}
+			else if (tokenEquals(cursor, key, "rotation") && tokenNext(cursor, token, ' '))
+			{
+				if (tokenEquals(cursor, token, "at"))
+					parseClockTimes(cursor, greenhouse.rules, JOB_ROTATE);
+				else
+					rotationTiming = tokenToFloat(cursor, token);
+			}
+			else if (tokenEquals(cursor, key, "quiet"))
+				parseQuiet(cursor, greenhouse.rules);
+			else if (tokenEquals(cursor, key, "date"))
+			{
+				if (tokenNext(cursor, token, ' ')) day = tokenToLong(cursor, token);
+				if (tokenNext(cursor, token, ' ')) month = tokenToLong(cursor, token);
+				if (tokenNext(cursor, token, ' ')) year = tokenToLong(cursor, token);
+			}
+			else if (tokenEquals(cursor, key, "time"))
+			{
+				if (tokenNext(cursor, token, ' ')) hour = tokenToLong(cursor, token);
+				if (tokenNext(cursor, token, ' ')) minute = tokenToLong(cursor, token);
+				if (tokenNext(cursor, token, ' ')) period = (line[token.start] == 'p') ? 1 : 0;
+				timeGiven = true;
+			}
+			else if (tokenEquals(cursor, key, "profile") && numProfiles < MAX_PROFILES && tokenNext(cursor, token, ' '))
+			{
+				tokenCopy(cursor, token, profileNames[numProfiles], CONFIG_NAME_SIZE);
+				profileWater[numProfiles] = waterTiming;
+				profileRotation[numProfiles] = rotationTiming;
+				if (tokenNext(cursor, token, ' ')) profileWater[numProfiles] = tokenToFloat(cursor, token);
+				if (tokenNext(cursor, token, ' ')) profileRotation[numProfiles] = tokenToFloat(cursor, token);
+				numProfiles++;
+			}
+			else if (tokenEquals(cursor, key, "plant") && tokenNext(cursor, token, ' '))
+				tokenCopy(cursor, token, plantProfile, CONFIG_NAME_SIZE);
+			else if (tokenEquals(cursor, key, "adapt"))
+				adaptAll = true;
+			else if (tokenEquals(cursor, key, "moisture") && tokenNext(cursor, token, ' '))
+			{
+				int bedNumber = tokenToLong(cursor, token) - 1;
+				if (bedNumber >= 0 && bedNumber < greenhouse.numBeds && tokenNext(cursor, token, ' '))
+				{
+					//a new moisture setting replaces the bed's old sensor, which frees its port
+					greenhouse.bed[bedNumber].moisturePort = -1;
+					int port = tokenToLong(cursor, token) - 1;
+					if (port >= 0 && port <= 3 && !sensorPortInUse(greenhouse, port))
+						greenhouse.bed[bedNumber].moisturePort = port;
+					greenhouse.bed[bedNumber].moistureDry = 0;
+					greenhouse.bed[bedNumber].moistureWet = 0;
+					greenhouse.bed[bedNumber].moistureTarget = 50;
+					if (tokenNext(cursor, token, ' ')) greenhouse.bed[bedNumber].moistureDry = tokenToLong(cursor, token);
+					if (tokenNext(cursor, token, ' ')) greenhouse.bed[bedNumber].moistureWet = tokenToLong(cursor, token);
+					if (tokenNext(cursor, token, ' ')) greenhouse.bed[bedNumber].moistureTarget = tokenToFloat(cursor, token);
+					greenhouse.bed[bedNumber].adaptive = greenhouse.bed[bedNumber].moisturePort >= 0;
+				}
+			}
+			else if (tokenEquals(cursor, key, "zone") && tokenNext(cursor, token, ' '))
+			{
+				int bedNumber = tokenToLong(cursor, token) - 1;
+				if (bedNumber >= 0 && bedNumber < greenhouse.numBeds && greenhouse.bed[bedNumber].numZones < MAX_ZONES)
+					parseZone(cursor, greenhouse.bed[bedNumber]);
+			}
+			else if (tokenEquals(cursor, key, "bed") && greenhouse.numBeds < MAX_BEDS)
+			{
+				if (parseBed(cursor, greenhouse.bed[greenhouse.numBeds])
+					&& !bedWiringClashes(greenhouse, greenhouse.bed[greenhouse.numBeds]))
+					greenhouse.numBeds++;
+			}
+		}
+		length = readConfigLine(fileHandle, line);
+	}
+	fileClose(fileHandle);
+
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (adaptAll)
+			greenhouse.bed[i].adaptive = true;
+		for (int zone = 0; zone < greenhouse.bed[i].numZones; zone++) //first run: the most frequent zone (see finishJob)
+		{
+			if (zone == 0 || greenhouse.bed[i].zoneInterval[zone] < greenhouse.bed[i].waterInterval)
+				greenhouse.bed[i].waterInterval = greenhouse.bed[i].zoneInterval[zone];
+		}
+	}
+
+	//profiles may be defined after the plant line
+	bool profileFound = false;
+	for (int i = 0; i < numProfiles; i++)
+	{
+		if (strcmp(profileNames[i], plantProfile) == 0)
+		{
+			waterTiming = profileWater[i];
+			rotationTiming = profileRotation[i];
+			profileFound = true;
+		}
+	}
+	if (!profileFound && plantProfile[0] != 0)
+	{
+		plantPreset = findPreset(plantProfile);
+		profileFound = (plantPreset != PRESET_NONE);
+	}
+	if (profileFound && !nameGiven)
+		stringFromChars(plantName, plantProfile);
+	return timeGiven;
+}
+
+/*
+Schedule state saved to CHECKPOINT_FILE (along with the state of each bed)
+runTime is the run time carried over from before this boot (the true value is runTime + T1)
+clockStart is the wall clock at run time 0 (see setClockNow), so a resumed schedule keeps the time of day
+*/
+typedef struct
+{
+	float settings[10]; //see task main
+	long runTime;
+	long clockStart;
+} tCheckpoint;
+
+/*
+Starts a new schedule (nothing carried over)
+*/
+void initCheckpoint(tCheckpoint& checkpoint)
+{
+	for (int i = 0; i < 10; i++)
+		checkpoint.settings[i] = 0;
+	checkpoint.runTime = 0;
+	checkpoint.clockStart = 0;
+}
+
+/*
+Writes one value to the checkpoint and adds it to the checksum
+*/
+void writeCheckpointLong(long fileHandle, long value, long& checksum)
+{
+	fileWriteLong(fileHandle, value);
+	checksum += value;
+}
+
+bool readCheckpointLong(long fileHandle, long& value, long& checksum)
+{
+	if (!fileReadLong(fileHandle, &value))
+		return false;
+	checksum += value;
+	return true;
+}
+
+/*
+Writes the schedule state to the brick (with a checksum, so a save cut short by a restart is ignored)
+The elapsed times of the beds are updated by activateGreenhouse before saving
+Returns false if the file cannot be opened
+*/
+bool saveCheckpoint(tCheckpoint& checkpoint, tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenWrite(CHECKPOINT_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	writeCheckpointLong(fileHandle, CHECKPOINT_MAGIC, checksum);
+	for (int i = 0; i < 10; i++)
+	{
+		fileWriteFloat(fileHandle, checkpoint.settings[i]);
+		checksum += (long)checkpoint.settings[i];
+	}
+	writeCheckpointLong(fileHandle, checkpoint.runTime + time1[T1], checksum);
+	writeCheckpointLong(fileHandle, clockStart, checksum);
+	writeCheckpointLong(fileHandle, greenhouse.numBeds, checksum);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].waterElapsed, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationElapsed, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].orientation, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].clockwise, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].waterCycles, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationCycles, checksum);
+		for (int face = 0; face < 4; face++)
+			writeCheckpointLong(fileHandle, greenhouse.bed[i].faceExposure[face], checksum);
+	}
+	fileWriteLong(fileHandle, checksum);
+	fileClose(fileHandle);
+	return true;
+}
+
+/*
+Reads the schedule state saved before the last restart (beds must already be configured)
+Returns false if there is no complete checkpoint for this set of beds
+*/
+bool loadCheckpoint(tCheckpoint& checkpoint, tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenRead(CHECKPOINT_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	long magic = 0;
+	long numBeds = 0;
+	long values[10*MAX_BEDS];
+	long savedChecksum = 0;
+	bool valid = readCheckpointLong(fileHandle, magic, checksum) && (magic == CHECKPOINT_MAGIC);
+
+	for (int i = 0; i < 10 && valid; i++)
+	{
+		valid = fileReadFloat(fileHandle, &checkpoint.settings[i]);
+		checksum += (long)checkpoint.settings[i];
+	}
+	valid = valid && readCheckpointLong(fileHandle, checkpoint.runTime, checksum)
+		&& readCheckpointLong(fileHandle, checkpoint.clockStart, checksum)
+		&& readCheckpointLong(fileHandle, numBeds, checksum) && (numBeds == greenhouse.numBeds);
+	for (int i = 0; i < 10*numBeds && valid; i++)
+		valid = readCheckpointLong(fileHandle, values[i], checksum);
+	valid = valid && fileReadLong(fileHandle, &savedChecksum) && (savedChecksum == checksum);
+	fileClose(fileHandle);
+
+	for (int i = 0; i < numBeds && valid; i++)
+	{
+		greenhouse.bed[i].waterElapsed = values[10*i];
+		greenhouse.bed[i].rotationElapsed = values[10*i + 1];
+		greenhouse.bed[i].orientation = values[10*i + 2];
+		if (greenhouse.bed[i].orientation == ORIENTATION_UNKNOWN) //put back at the start before the restart, as
+			greenhouse.bed[i].orientation = 0; //the stats asked (side 0 facing the light)
+		greenhouse.bed[i].clockwise = (values[10*i + 3] != 0);
+		greenhouse.bed[i].waterCycles = values[10*i + 4];
+		greenhouse.bed[i].rotationCycles = values[10*i + 5];
+		for (int face = 0; face < 4; face++)
+			greenhouse.bed[i].faceExposure[face] = values[10*i + 6 + face];
+	}
+	if (!valid)
+		initCheckpoint(checkpoint);
+	return valid;
+}
+
+/*
+Relay test of a bed's rotation: the power switches between bias + TUNE_RELAY_POWER and
+bias - TUNE_RELAY_POWER each time the measured value crosses its target, so the base oscillates
+speedTest false: the value is the encoder count, the target is where the base started
+speedTest true: the value is the encoder counts per sample, the target is the speed at ROTATION_SPEED
+ultimateGain and ultimatePeriod (seconds) update from the size and length of the oscillation
+Returns false if the base did not oscillate
+*/
+bool relayTest(tBed& bed, bool speedTest, float& ultimateGain, float& ultimatePeriod)
+{
+	int bias = 0;
+	float target = 0;
+	long lastCount = 0;
+	resetActuatorEncoder(bed.rotation);
+	if (speedTest)
+	{
+		driveActuator(bed.rotation, ROTATION_SPEED);
+		wait1Msec(TUNE_SETTLE_TIME); //spin up
+		lastCount = actuatorEncoder(bed.rotation);
+		wait1Msec(TUNE_SETTLE_TIME);
+		bias = ROTATION_SPEED;
+		target = (float)(actuatorEncoder(bed.rotation) - lastCount)*TUNE_SAMPLE_TIME/TUNE_SETTLE_TIME;
+		lastCount = actuatorEncoder(bed.rotation);
+	}
+
+	bool above = false; //value above target
+	int crossings = 0;
+	int cycles = 0; //measured cycles (between falling crossings)
+	float high = target; //extremes of the current cycle
+	float low = target;
+	float amplitude = 0; //sum over the measured cycles
+	long cycleStart = -1;
+	long measuredTime = 0;
+	float startTime = time1[T1]; //fail-safe
+	driveActuator(bed.rotation, bias + TUNE_RELAY_POWER);
+	while ((crossings < TUNE_CROSSINGS) && (time1[T1] - startTime < TUNE_MAX_TIME) && (SensorValue[S3] == 0))
+	{
+		wait1Msec(TUNE_SAMPLE_TIME);
+		long count = actuatorEncoder(bed.rotation);
+		float value = count;
+		if (speedTest)
+			value = count - lastCount;
+		lastCount = count;
+		if (value > high)
+			high = value;
+		if (value < low)
+			low = value;
+
+		if ((value > target) != above) //crossed the target, switch the relay
+		{
+			above = !above;
+			crossings++;
+			if (above)
+				driveActuator(bed.rotation, bias - TUNE_RELAY_POWER);
+			else
+			{
+				driveActuator(bed.rotation, bias + TUNE_RELAY_POWER);
+				if (crossings > TUNE_SETTLE_CROSSINGS && cycleStart >= 0)
+				{
+					amplitude += (high - low)/2;
+					measuredTime += time1[T1] - cycleStart;
+					cycles++;
+				}
+				cycleStart = time1[T1];
+				high = value;
+				low = value;
+			}
+		}
+	}
+	driveActuator(bed.rotation, 0);
+
+	//back to where the test started (keeps the base within its cable range)
+	int direction = 1;
+	if (actuatorEncoder(bed.rotation) > 0)
+		direction = -1;
+	startTime = time1[T1];
+	driveActuator(bed.rotation, direction*ROTATION_SPEED);
+	while ((direction*actuatorEncoder(bed.rotation) < 0) && (time1[T1] - startTime < bed.calibration.maxRotationTime))
+	{}
+	driveActuator(bed.rotation, 0);
+
+	if (cycles == 0 || amplitude <= 0)
+		return false;
+	ultimateGain = 4.0*TUNE_RELAY_POWER/(PI*amplitude/cycles);
+	ultimatePeriod = measuredTime/1000.0/cycles;
+	return true;
+}
+
+/*
+Converts a gain to a multiplexer register value (unsigned short)
+*/
+long pidRegister(float gain)
+{
+	long value = (long)(gain*PID_GAIN_SCALE);
+	if (value < 0)
+		return 0;
+	if (value > 65535)
+		return 65535;
+	return value;
+}
+
+/*
+Ziegler-Nichols gains from the relay test (no-overshoot rule), in register values
+*/
+void zieglerNichols(float ultimateGain, float ultimatePeriod, long& kp, long& ki, long& kd)
+{
+	kp = pidRegister(0.2*ultimateGain);
+	ki = pidRegister(0.4*ultimateGain/ultimatePeriod);
+	kd = pidRegister(0.066*ultimateGain*ultimatePeriod);
+}
+
+/*
+Tunes the multiplexer PID of a bed's rotation with a position (tacho) and a speed relay test
+Returns false if the bed has no multiplexer rotation or a test fails (the factory gains are kept)
+*/
+bool tuneRotation(tBed& bed)
+{
+	if (!bed.rotation.connected || !bed.rotation.onMux)
+		return false;
+	float ultimateGain = 0;
+	float ultimatePeriod = 0;
+	tPidGains gains;
+
+	MSMMotorSetSpeedCtrl(bed.rotation.muxPort, false); //raw power during the tests
+	bool tuned = relayTest(bed, false, ultimateGain, ultimatePeriod);
+	if (tuned)
+		zieglerNichols(ultimateGain, ultimatePeriod, gains.kpTacho, gains.kiTacho, gains.kdTacho);
+	tuned = tuned && relayTest(bed, true, ultimateGain, ultimatePeriod);
+	if (tuned)
+		zieglerNichols(ultimateGain, ultimatePeriod, gains.kpSpeed, gains.kiSpeed, gains.kdSpeed);
+	MSMMotorSetSpeedCtrl(bed.rotation.muxPort, true);
+
+	if (tuned)
+	{
+		gains.tuned = true;
+		memcpy(bed.rotationPid, gains, sizeof(gains));
+	}
+	return tuned;
+}
+
+/*
+Sends a bed's tuned gains to its rotation multiplexer (beds sharing a multiplexer share its gains)
+*/
+void applyRotationPid(tBed& bed)
+{
+	if (bed.rotationPid.tuned && bed.rotation.connected && bed.rotation.onMux)
+		MSMMUXsetPID((tSensors)SPORT(bed.rotation.muxPort), bed.rotationPid.kpTacho, bed.rotationPid.kiTacho,
+			bed.rotationPid.kdTacho, bed.rotationPid.kpSpeed, bed.rotationPid.kiSpeed, bed.rotationPid.kdSpeed,
+			PID_PASS_COUNT, PID_TOLERANCE);
+}
+
+/*
+Writes the tuned gains of every bed to PID_FILE (same layout and checksum as the checkpoint)
+Returns false if the file cannot be opened
+*/
+bool savePidGains(tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenWrite(PID_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	writeCheckpointLong(fileHandle, PID_MAGIC, checksum);
+	writeCheckpointLong(fileHandle, greenhouse.numBeds, checksum);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.tuned, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kpTacho, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kiTacho, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kdTacho, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kpSpeed, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kiSpeed, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].rotationPid.kdSpeed, checksum);
+	}
+	fileWriteLong(fileHandle, checksum);
+	fileClose(fileHandle);
+	return true;
+}
+
+/*
+Reads the gains saved by savePidGains (beds must already be configured)
+Returns false if there are no complete gains for this set of beds
+*/
+bool loadPidGains(tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenRead(PID_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	long magic = 0;
+	long numBeds = 0;
+	long values[7*MAX_BEDS];
+	long savedChecksum = 0;
+	bool valid = readCheckpointLong(fileHandle, magic, checksum) && (magic == PID_MAGIC)
+		&& readCheckpointLong(fileHandle, numBeds, checksum) && (numBeds == greenhouse.numBeds);
+	for (int i = 0; i < 7*numBeds && valid; i++)
+		valid = readCheckpointLong(fileHandle, values[i], checksum);
+	valid = valid && fileReadLong(fileHandle, &savedChecksum) && (savedChecksum == checksum);
+	fileClose(fileHandle);
+
+	for (int i = 0; i < numBeds && valid; i++)
+	{
+		greenhouse.bed[i].rotationPid.tuned = (values[7*i] != 0);
+		greenhouse.bed[i].rotationPid.kpTacho = values[7*i + 1];
+		greenhouse.bed[i].rotationPid.kiTacho = values[7*i + 2];
+		greenhouse.bed[i].rotationPid.kdTacho = values[7*i + 3];
+		greenhouse.bed[i].rotationPid.kpSpeed = values[7*i + 4];
+		greenhouse.bed[i].rotationPid.kiSpeed = values[7*i + 5];
+		greenhouse.bed[i].rotationPid.kdSpeed = values[7*i + 6];
+	}
+	return valid;
+}
+
+/*
+Initializes the multiplexers (must be done in a function, not globally) and applies any saved gains
+*/
+void initMultiplexers(tGreenhouse& greenhouse)
+{
+	MSMMUXinit();
+	wait1Msec(50);
+	if (loadPidGains(greenhouse))
+	{
+		for (int i = 0; i < greenhouse.numBeds; i++)
+			applyRotationPid(greenhouse.bed[i]);
+	}
+}
+
+/*
+Tunes the rotation of every bed, then saves and applies the gains
+*/
+void tuneGreenhouse(tGreenhouse& greenhouse)
+{
+	char text[DISPLAY_TEXT_SIZE];
+	clearScreen();
+	showLine(3, "Tuning rotation...");
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (tuneRotation(greenhouse.bed[i]))
+		{
+			applyRotationPid(greenhouse.bed[i]);
+			sprintf(text, "Bed %d tuned", i + 1);
+		}
+		else
+			sprintf(text, "Bed %d not tuned", i + 1);
+		showLine(4 + i, text);
+	}
+	savePidGains(greenhouse);
+	waitMessage();
+	clearScreen();
+	showLine(7, ""); //line of the fourth bed
+}
+
+/*
+Drives an axis (and its second motor, if connected) until it stalls at the end of its rail
+Returns the time until it stopped moving (ms), or -1 if it did not stall (fail-safe or emergency stop)
+*/
+long driveToStall(tActuator& axis, tActuator& axis2, int power)
+{
+	float startTime = time1[T1];
+	float lastMove = startTime;
+	long lastCount = actuatorEncoder(axis);
+	driveActuator(axis2, power);
+	driveActuator(axis, power);
+	while ((time1[T1] - lastMove < STALL_TIME) && (time1[T1] - startTime < CALIBRATION_MAX_TIME)
+		&& (SensorValue[S3] == 0))
+	{
+		wait1Msec(STALL_SAMPLE_TIME);
+		long count = actuatorEncoder(axis);
+		if (abs(count - lastCount) > STALL_COUNTS)
+		{
+			lastCount = count;
+			lastMove = time1[T1];
+		}
+	}
+	driveActuator(axis2, 0);
+	driveActuator(axis, 0);
+
+	if (time1[T1] - lastMove < STALL_TIME)
+		return -1;
+	return lastMove - startTime;
+}
+
+/*
+Measures a bed: each axis is driven to both ends of its rail (travel and run time),
+and the base is turned a quarter turn and back (run time; the base has no end stop)
+The axes finish at the start of their rails
+Returns false if a measurement fails (the bed keeps its previous calibration)
+*/
+bool calibrateBed(tBed& bed)
+{
+	tActuator none; //y axis has one motor
+	disconnectActuator(none);
+	tCalibration calibration;
+	memcpy(calibration, bed.calibration, sizeof(calibration));
+	bool calibrated = true;
+
+	if (bed.xAxis.connected)
+	{
+		calibrated = (driveToStall(bed.xAxis, bed.xAxis2, -X_AXIS_SPEED) >= 0);
+		resetActuatorEncoder(bed.xAxis);
+		long railTime = driveToStall(bed.xAxis, bed.xAxis2, X_AXIS_SPEED);
+		long railCounts = abs(actuatorEncoder(bed.xAxis));
+		calibrated = calibrated && (railTime > 0) && (railCounts > 0);
+		if (calibrated)
+		{
+			calibration.xTravel = railCounts*X_AXIS_LENGTH/X_RAIL_LENGTH;
+			calibration.xReturn = railCounts*(X_AXIS_LENGTH+BUFFER_LENGTH)/X_RAIL_LENGTH;
+			calibration.maxXTime = CALIBRATION_TIME_MARGIN*railTime*(X_AXIS_LENGTH+BUFFER_LENGTH)/X_RAIL_LENGTH;
+			calibration.maxPumpTime = calibration.maxXTime + PUMP_TIME_MARGIN;
+		}
+		driveToStall(bed.xAxis, bed.xAxis2, -X_AXIS_SPEED); //back to the start
+	}
+
+	if (calibrated && bed.yAxis.connected)
+	{
+		calibrated = (driveToStall(bed.yAxis, none, -Y_AXIS_SPEED) >= 0);
+		resetActuatorEncoder(bed.yAxis);
+		long railTime = driveToStall(bed.yAxis, none, Y_AXIS_SPEED);
+		long railCounts = abs(actuatorEncoder(bed.yAxis));
+		calibrated = calibrated && (railTime > 0) && (railCounts > 0);
+		if (calibrated)
+		{
+			calibration.yTravel = railCounts*Y_AXIS_LENGTH/Y_RAIL_LENGTH;
+			calibration.maxYTime = CALIBRATION_TIME_MARGIN*railTime*Y_AXIS_LENGTH/Y_RAIL_LENGTH;
+		}
+		driveToStall(bed.yAxis, none, -Y_AXIS_SPEED);
+	}
+
+	if (calibrated && bed.rotation.connected)
+	{
+		float startTime = time1[T1];
+		resetActuatorEncoder(bed.rotation);
+		driveActuator(bed.rotation, ROTATION_SPEED);
+		while ((abs(actuatorEncoder(bed.rotation)) < calibration.rotationTravel)
+			&& (time1[T1] - startTime < CALIBRATION_MAX_TIME) && (SensorValue[S3] == 0))
+		{}
+		driveActuator(bed.rotation, 0);
+		calibrated = (abs(actuatorEncoder(bed.rotation)) >= calibration.rotationTravel);
+		if (calibrated)
+			calibration.maxRotationTime = CALIBRATION_TIME_MARGIN*(time1[T1] - startTime);
+
+		//turn back (keeps the cable in range)
+		startTime = time1[T1];
+		driveActuator(bed.rotation, -ROTATION_SPEED);
+		while ((actuatorEncoder(bed.rotation) > 0) && (time1[T1] - startTime < CALIBRATION_MAX_TIME))
+		{}
+		driveActuator(bed.rotation, 0);
+	}
+
+	if (calibrated)
+	{
+		calibration.calibrated = true;
+		memcpy(bed.calibration, calibration, sizeof(calibration));
+	}
+	return calibrated;
+}
+
+/*
+Writes the calibration of every bed to CALIBRATION_FILE (same layout and checksum as the checkpoint)
+Returns false if the file cannot be opened
+*/
+bool saveCalibration(tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenWrite(CALIBRATION_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	writeCheckpointLong(fileHandle, CALIBRATION_MAGIC, checksum);
+	writeCheckpointLong(fileHandle, greenhouse.numBeds, checksum);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.calibrated, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.xTravel, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.xReturn, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.yTravel, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.rotationTravel, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.maxXTime, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.maxYTime, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.maxPumpTime, checksum);
+		writeCheckpointLong(fileHandle, greenhouse.bed[i].calibration.maxRotationTime, checksum);
+	}
+	fileWriteLong(fileHandle, checksum);
+	fileClose(fileHandle);
+	return true;
+}
+
+/*
+Reads the calibration saved by saveCalibration (beds must already be configured)
+Returns false if there is no complete calibration for this set of beds (the defaults are kept)
+*/
+bool loadCalibration(tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenRead(CALIBRATION_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	long magic = 0;
+	long numBeds = 0;
+	long values[9*MAX_BEDS];
+	long savedChecksum = 0;
+	bool valid = readCheckpointLong(fileHandle, magic, checksum) && (magic == CALIBRATION_MAGIC)
+		&& readCheckpointLong(fileHandle, numBeds, checksum) && (numBeds == greenhouse.numBeds);
+	for (int i = 0; i < 9*numBeds && valid; i++)
+		valid = readCheckpointLong(fileHandle, values[i], checksum);
+	valid = valid && fileReadLong(fileHandle, &savedChecksum) && (savedChecksum == checksum);
+	fileClose(fileHandle);
+
+	for (int i = 0; i < numBeds && valid; i++)
+	{
+		if (values[9*i] != 0) //uncalibrated beds keep the defaults
+		{
+			greenhouse.bed[i].calibration.calibrated = true;
+			greenhouse.bed[i].calibration.xTravel = values[9*i + 1];
+			greenhouse.bed[i].calibration.xReturn = values[9*i + 2];
+			greenhouse.bed[i].calibration.yTravel = values[9*i + 3];
+			greenhouse.bed[i].calibration.rotationTravel = values[9*i + 4];
+			greenhouse.bed[i].calibration.maxXTime = values[9*i + 5];
+			greenhouse.bed[i].calibration.maxYTime = values[9*i + 6];
+			greenhouse.bed[i].calibration.maxPumpTime = values[9*i + 7];
+			greenhouse.bed[i].calibration.maxRotationTime = values[9*i + 8];
+		}
+	}
+	return valid;
+}
+
+/*
+Calibrates every bed, then saves the calibration
+*/
+void calibrateGreenhouse(tGreenhouse& greenhouse)
+{
+	char text[DISPLAY_TEXT_SIZE];
+	clearScreen();
+	showLine(3, "Calibrating...");
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (calibrateBed(greenhouse.bed[i]))
+			sprintf(text, "Bed %d calibrated", i + 1);
+		else
+			sprintf(text, "Bed %d not calibrated", i + 1);
+		showLine(4 + i, text);
+	}
+	saveCalibration(greenhouse);
+	waitMessage();
+	clearScreen();
+	showLine(7, ""); //line of the fourth bed
+}
+
+/*
+Writes the tank gauge calibration of every sensor port to TANK_GAUGE_FILE
+Returns false if the file cannot be opened
+*/
+bool saveTankGauges()
+{
+	long fileHandle = fileOpenWrite(TANK_GAUGE_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	writeCheckpointLong(fileHandle, TANK_GAUGE_MAGIC, checksum);
+	for (int port = 0; port < 4; port++)
+	{
+		writeCheckpointLong(fileHandle, tankGauged[port], checksum);
+		for (int i = 0; i < TANK_GAUGE_POINTS; i++)
+			writeCheckpointLong(fileHandle, tankGaugeRaw[port*TANK_GAUGE_POINTS + i], checksum);
+	}
+	fileWriteLong(fileHandle, checksum);
+	fileClose(fileHandle);
+	return true;
+}
+
+/*
+Reads the calibration saved by saveTankGauges
+Returns false if there is none (every tank is then read from the float colour)
+*/
+bool loadTankGauges()
+{
+	for (int port = 0; port < 4; port++)
+		tankGauged[port] = false;
+	long fileHandle = fileOpenRead(TANK_GAUGE_FILE);
+	if (fileHandle < 0)
+		return false;
+
+	long checksum = 0;
+	long magic = 0;
+	long gauged[4];
+	long values[4*TANK_GAUGE_POINTS];
+	long savedChecksum = 0;
+	bool valid = readCheckpointLong(fileHandle, magic, checksum) && (magic == TANK_GAUGE_MAGIC);
+	for (int port = 0; port < 4 && valid; port++)
+	{
+		valid = readCheckpointLong(fileHandle, gauged[port], checksum);
+		for (int i = 0; i < TANK_GAUGE_POINTS && valid; i++)
+			valid = readCheckpointLong(fileHandle, values[port*TANK_GAUGE_POINTS + i], checksum);
+	}
+	valid = valid && fileReadLong(fileHandle, &savedChecksum) && (savedChecksum == checksum);
+	fileClose(fileHandle);
+
+	for (int port = 0; port < 4 && valid; port++)
+	{
+		tankGauged[port] = (gauged[port] != 0);
+		for (int i = 0; i < TANK_GAUGE_POINTS; i++)
+			tankGaugeRaw[port*TANK_GAUGE_POINTS + i] = values[port*TANK_GAUGE_POINTS + i];
+	}
+	return valid;
+}
+
+/*
+Calibrates the gauge of every tank in use: the user fills the tank to each calibration point
+in turn and presses ENTER, and the average reflected light on the float is recorded
+*/
+void calibrateTankGauges(tGreenhouse& greenhouse)
+{
+	char text[DISPLAY_TEXT_SIZE];
+	watchTanks(greenhouse);
+	for (int port = 0; port < 4; port++)
+	{
+		if (!tankWatched[port])
+			continue;
+		SensorMode[(tSensors)port] = modeEV3Color_Reflected;
+		wait1Msec(50);
+		for (int i = 0; i < TANK_GAUGE_POINTS; i++)
+		{
+			clearScreen();
+			sprintf(text, "Tank on S%d:", port + 1);
+			showLine(3, text);
+			sprintf(text, "Fill to %d%%", gaugePointLevel(i));
+			showLine(4, text);
+			showLine(5, "Then press enter");
+			while (!getButtonPress(buttonEnter))
+			{}
+			while (getButtonPress(buttonAny))
+			{}
+			wait1Msec(50); //buffer
+			long total = 0;
+			for (int j = 0; j < TANK_GAUGE_SAMPLES; j++)
+			{
+				total += SensorValue[(tSensors)port];
+				wait1Msec(TANK_SAMPLE_TIME);
+			}
+			tankGaugeRaw[port*TANK_GAUGE_POINTS + i] = total/TANK_GAUGE_SAMPLES;
 		}
-		else if (getButtonPress(buttonEnter))timeSet++;
-		wait1Msec(500);
+		tankGauged[port] = true;
 	}
+	saveTankGauges();
+	clearScreen();
+}
 
-	while (timeSet == 2)
+/*
+Energy of a bed's actuators since start-up (J), brought up to date first
+*/
+float waterEnergy(tBed& bed) //x and y axes and pump
+{
+	accountActuator(bed.xAxis);
+	accountActuator(bed.xAxis2);
+	accountActuator(bed.yAxis);
+	accountActuator(bed.pump);
+	return bed.xAxis.energy + bed.xAxis2.energy + bed.yAxis.energy + bed.pump.energy;
+}
+
+float rotationEnergy(tBed& bed)
+{
+	accountActuator(bed.rotation);
+	return bed.rotation.energy;
+}
+
+/*
+Average energy per cycle (J), 0 before the first cycle
+*/
+long perCycle(float energy, long cycles)
+{
+	if (cycles <= 0)
+		return 0;
+	return energy/cycles;
+}
+
+/*
+Shows an actuator's on time, energy and energy per cycle (on time and energy of a second motor are added)
+*/
+void showEnergyLine(int line, const char* label, tActuator& actuator, tActuator& actuator2, long cycles)
+{
+	char text[DISPLAY_TEXT_SIZE];
+	accountActuator(actuator);
+	accountActuator(actuator2);
+	float energy = actuator.energy + actuator2.energy;
+	long onTime = actuator.onTime + actuator2.onTime;
+	sprintf(text, "%s %ds %dJ %dJ/c", label, onTime/1000, (long)energy, perCycle(energy, cycles));
+	showLine(line, text);
+}
+
+/*
+Writes the coverage maps to COVERAGE_FILE: one row per x cell of each bed, ms pumped over each y cell
+*/
+void writeCoverage(tGreenhouse& greenhouse)
+{
+	long fileHandle = fileOpenWrite(COVERAGE_FILE);
+	if (fileHandle < 0)
+		return;
+	char line[80];
+	sprintf(line, "bed,x_cell,y_cells_ms\n");
+	fileWriteData(fileHandle, line, strlen(line));
+	for (int i = 0; i < greenhouse.numBeds; i++)
 	{
-		while(!getButtonPress(buttonAny))
-		{}
-		if (getButtonPress(buttonUp) || getButtonPress(buttonDown))
+		for (int x = 0; x < COVERAGE_X_CELLS; x++)
 		{
-			if (period == 0) period = 1;
-			else period = 0;
+			sprintf(line, "%d,%d", i + 1, x);
+			fileWriteData(fileHandle, line, strlen(line));
+			for (int y = 0; y < COVERAGE_Y_CELLS; y++)
+			{
+				sprintf(line, ",%d", greenhouse.bed[i].coverage[x*COVERAGE_Y_CELLS + y]);
+				fileWriteData(fileHandle, line, strlen(line));
+			}
+			sprintf(line, "\n");
+			fileWriteData(fileHandle, line, strlen(line));
 		}
+	}
+	fileClose(fileHandle);
+}
 
-		string periodDisplay = " ";
-		if (period == 0) periodDisplay = "a.m.";
-		else periodDisplay = "p.m.";
-		// generate updated time after toggling
-		if (minute< 10) displayTextLine(4, "%d:0%d %s", hour, minute, periodDisplay);
-		else displayTextLine(4, "%d:%d %s", hour, minute, periodDisplay);
-
-		if (getButtonPress(buttonEnter)) timeSet = 3;
-
-		wait1Msec(500);
+/*
+Telemetry: every TELEMETRY_INTERVAL of run time a file of its own, with a header and one CSV row per bed
+The file is closed straight away, so a crash or a pulled battery loses at most the row being written
+Files are numbered by run time, which carries over a restart, so resuming continues the series instead
+of overwriting it; after TELEMETRY_FILES the oldest is reused
+*/
+void writeTelemetry(tCheckpoint& checkpoint, tGreenhouse& greenhouse)
+{
+	char line[80];
+	long runTime = checkpoint.runTime + time1[T1];
+	sprintf(line, TELEMETRY_FILE, (runTime/TELEMETRY_INTERVAL) % TELEMETRY_FILES);
+	long fileHandle = fileOpenWrite(line);
+	if (fileHandle < 0)
+		return;
+	sprintf(line, "time_ms,bed,water_cycles,rotations,tank_percent,tank_ml,empty_in_ms,");
+	fileWriteData(fileHandle, line, strlen(line));
+	sprintf(line, "x_on_ms,y_on_ms,pump_on_ms,rotation_on_ms,"); //x: both x motors, like x energy
+	fileWriteData(fileHandle, line, strlen(line));
+	sprintf(line, "water_j,rotation_j,j_per_water_cycle,j_per_rotation,");
+	fileWriteData(fileHandle, line, strlen(line));
+	sprintf(line, "demand_percent,water_interval_ms,pump_speed,");
+	fileWriteData(fileHandle, line, strlen(line));
+	sprintf(line, "coverage_min_ms,coverage_max_ms,dry_cells\n");
+	fileWriteData(fileHandle, line, strlen(line));
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		int port = greenhouse.bed[i].fillSensor;
+		sprintf(line, "%d,%d,%d,%d,%d,%d,%d,", runTime, i + 1, greenhouse.bed[i].waterCycles,
+			greenhouse.bed[i].rotationCycles, (long)tankLevel[port], (long)tankRemaining(port),
+			tankTimeToEmpty(greenhouse, port));
+		fileWriteData(fileHandle, line, strlen(line));
+		float water = waterEnergy(greenhouse.bed[i]); //brings the on times up to date
+		float rotation = rotationEnergy(greenhouse.bed[i]);
+		sprintf(line, "%d,%d,%d,%d,", greenhouse.bed[i].xAxis.onTime + greenhouse.bed[i].xAxis2.onTime,
+			greenhouse.bed[i].yAxis.onTime, greenhouse.bed[i].pump.onTime, greenhouse.bed[i].rotation.onTime);
+		fileWriteData(fileHandle, line, strlen(line));
+		sprintf(line, "%d,%d,%d,%d,", (long)water, (long)rotation, perCycle(water, greenhouse.bed[i].pumpCycles),
+			perCycle(rotation, greenhouse.bed[i].turnCycles));
+		fileWriteData(fileHandle, line, strlen(line));
+		sprintf(line, "%d,%d,%d,", (long)(100*greenhouse.bed[i].demand), (long)greenhouse.bed[i].waterInterval,
+			greenhouse.bed[i].pumpSpeed);
+		fileWriteData(fileHandle, line, strlen(line));
+		long least = 0;
+		long most = 0;
+		int dryCells = 0;
+		coverageSummary(greenhouse.bed[i], least, most, dryCells);
+		sprintf(line, "%d,%d,%d\n", least, most, dryCells);
+		fileWriteData(fileHandle, line, strlen(line));
 	}
-	clearScreen();
+	fileClose(fileHandle);
+	writeCoverage(greenhouse);
 }
 
 /*
 Displays plant's stats (name, number of cycles, current date and time, etc.)
 */
 void generateStats(string plantName, float timeWater, float timeRotation, float day, float month, float year,
-float hour, float minute, float& period, float newHour, float newMinute, bool executed, int taskFailed)
+float hour, float minute, float& period, float newHour, float newMinute, bool executed, int taskFailed,
+tCheckpoint& checkpoint, tGreenhouse& greenhouse)
 {
-	float runTime = time1[T1];
+	float runTime = checkpoint.runTime + time1[T1]; //includes time before any restart
+	char text[DISPLAY_TEXT_SIZE];
 
 	int daysInMonth[12] = {31, 28, 31, 30, 31, 30, 31 ,31 ,30, 31, 30, 31}; // index corresponds to month-1
 
@@ -376,21 +3638,106 @@ float hour, float minute, float& period, float newHour, float newMinute, bool ex
 
 
 	// display stats
-	displayTextLine(4, "Plant name: %s", plantName);
-	wait1Msec(WAIT_MESSAGE);
-	displayTextLine(4, "Total run time (ms): %d", runTime);
-	wait1Msec(WAIT_MESSAGE);
-	displayTextLine(4, "Water interval (ms): %d", timeWater);
-	wait1Msec(WAIT_MESSAGE);
-	displayTextLine(4, "Rotation interval (ms): %d", timeRotation);
-	wait1Msec(WAIT_MESSAGE);
+	sprintf(text, "Plant name: %s", plantName);
+	showLine(4, text);
+	waitMessage();
+	sprintf(text, "Run time (ms): %d", runTime);
+	showLine(4, text);
+	waitMessage();
+	sprintf(text, "Water every (ms): %d", timeWater);
+	showLine(4, text);
+	waitMessage();
+	sprintf(text, "Rotate every (ms): %d", timeRotation);
+	showLine(4, text);
+	waitMessage();
+
+	// idle duty and wake-ups of all tasks, and battery (the drain since start-up gives the battery life left)
+	if (idleTime > 0)
+	{
+		sprintf(text, "Idle CPU duty: %.1f%%", 100.0*idleBusyTime/idleTime);
+		showLine(4, text);
+		waitMessage();
+		sprintf(text, "Idle wakes: %.0f/min", 60000.0*idleWakeups/idleTime);
+		showLine(4, text);
+		waitMessage();
+	}
+	long batteryLevel = nAvgBatteryLevel;
+	float drainRate = (float)(startBatteryLevel - batteryLevel)/time1[T1]; //mV per ms
+	sprintf(text, "Battery: %d mV", batteryLevel);
+	showLine(4, text);
+	if (drainRate > 0 && batteryLevel > BATTERY_EMPTY_LEVEL)
+		sprintf(text, "Battery left: %dh", (batteryLevel - BATTERY_EMPTY_LEVEL)/drainRate/3600000);
+	else
+		sprintf(text, "Battery left: unknown");
+	showLine(5, text);
+	waitMessage();
+	showLine(5, "");
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		sprintf(text, "Bed %d: %s", i + 1, greenhouse.bed[i].name);
+		showLine(3, text);
+		sprintf(text, "Water cycles: %d", greenhouse.bed[i].waterCycles);
+		showLine(4, text);
+		sprintf(text, "Rotations: %d (%d turns)", greenhouse.bed[i].rotationCycles, greenhouse.bed[i].turnCycles);
+		showLine(5, text);
+		sprintf(text, "Tank: %d%% full", tankLevel[greenhouse.bed[i].fillSensor]);
+		showLine(6, text);
+		long emptyIn = tankTimeToEmpty(greenhouse, greenhouse.bed[i].fillSensor);
+		if (emptyIn < 0)
+			sprintf(text, "Tank empty in: unknown");
+		else
+			sprintf(text, "Tank empty in: %dh %dm", emptyIn/3600000, (emptyIn/60000)%60);
+		showLine(7, text);
+		waitMessage();
+
+		// daylight on each side of the plant (side 0 faced the light at the start)
+		updateExposure(greenhouse.bed[i]);
+		showLine(3, "Light per side (h)");
+		sprintf(text, "%d %d %d %d", greenhouse.bed[i].faceExposure[0]/3600000, greenhouse.bed[i].faceExposure[1]/3600000,
+			greenhouse.bed[i].faceExposure[2]/3600000, greenhouse.bed[i].faceExposure[3]/3600000);
+		showLine(4, text);
+		if (greenhouse.bed[i].orientation == ORIENTATION_UNKNOWN) //stopped part way through a turn
+			sprintf(text, "Turn back to side 0");
+		else
+			sprintf(text, "Facing light: side %d", faceOf(greenhouse.bed[i].orientation));
+		showLine(5, text);
+		if (greenhouse.bed[i].adaptive)
+		{
+			sprintf(text, "Water demand: %d%%", (long)(100*greenhouse.bed[i].demand));
+			showLine(6, text);
+		}
+		else
+			showLine(6, "");
+		long least = 0;
+		long most = 0;
+		int dryCells = 0;
+		coverageSummary(greenhouse.bed[i], least, most, dryCells);
+		sprintf(text, "Dry cells: %d of %d", dryCells, COVERAGE_CELLS);
+		showLine(7, text);
+		waitMessage();
+
+		// energy since start-up: on time, total, per cycle
+		tActuator none;
+		disconnectActuator(none);
+		showLine(3, "Energy (on, total, per cycle)");
+		showEnergyLine(4, "X:", greenhouse.bed[i].xAxis, greenhouse.bed[i].xAxis2, greenhouse.bed[i].pumpCycles);
+		showEnergyLine(5, "Y:", greenhouse.bed[i].yAxis, none, greenhouse.bed[i].pumpCycles);
+		showEnergyLine(6, "Pump:", greenhouse.bed[i].pump, none, greenhouse.bed[i].pumpCycles);
+		showEnergyLine(7, "Rot:", greenhouse.bed[i].rotation, none, greenhouse.bed[i].turnCycles);
+		waitMessage();
+	}
+	showLine(3, "");
+	showLine(5, "");
+	showLine(6, "");
+	showLine(7, "");
 
 	// correct display of date
 	if (month<10)
-		displayTextLine(4, "%d/0%d/%d", month, day, year);
+		sprintf(text, "%d/0%d/%d", month, day, year);
 	else
-		displayTextLine(4, "%d/%d/%d", month, day, year);
-	wait1Msec(WAIT_MESSAGE);
+		sprintf(text, "%d/%d/%d", month, day, year);
+	showLine(4, text);
+	waitMessage();
 
 	// correct display of time
 	string periodDisplay = " ";
@@ -399,123 +3746,559 @@ float hour, float minute, float& period, float newHour, float newMinute, bool ex
 	else 
 		periodDisplay = "p.m.";
 	if (newMinute < 10)
-		displayTextLine(4, "%d:0%d %s", newHour, newMinute, periodDisplay);
+		sprintf(text, "%d:0%d %s", newHour, newMinute, periodDisplay);
 	else
-		displayTextLine(4, "%d:%d %s", newHour, newMinute, periodDisplay);
-	wait1Msec(WAIT_MESSAGE);
+		sprintf(text, "%d:%d %s", newHour, newMinute, periodDisplay);
+	showLine(4, text);
+	waitMessage();
 	
+	if (emergencyStopped)
+	{
+		sprintf(text, "E-STOP: stopped in %d ms", estopLatency);
+		showLine(4, text);
+		sprintf(text, "at stall point %d", estopPhase);
+		showLine(5, text);
+		waitMessage();
+		showLine(5, "");
+	}
+
 	if (!executed)
 	{
-		displayTextLine(4, "ROBOT FAILURE:");
+		if (greenhouse.failedBed >= 0)
+			sprintf(text, "BED %d FAILURE:", greenhouse.failedBed + 1);
+		else
+			sprintf(text, "ROBOT FAILURE:");
+		showLine(4, text);
 		switch (taskFailed) //display reason
 		{
 			case 0:
-				displayTextLine(5, "UNKNOWN REASON");
+				showLine(5, "UNKNOWN REASON");
 				break; //break statement approved by teaching team**
 			case 1:
-				displayTextLine(5, "ROTATION FAILED");
+				showLine(5, "ROTATION FAILED");
 				break;
 			case 2:
-				displayTextLine(5, "PUMP FAILED");
+				showLine(5, "PUMP FAILED");
 				break;
 			case 3:
-				displayTextLine(5, "AXIS FAILED");
+				showLine(5, "AXIS FAILED");
+				break;
+			case 4:
+				sprintf(text, "WATCHDOG: POINT %d", watchdogPoint);
+				showLine(5, text);
 				break;
 			default:
-				displayTextLine(5, "UNKNOWN REASON");
+				showLine(5, "UNKNOWN REASON");
 		} 
-		wait1Msec(WAIT_MESSAGE);
+		waitMessage();
 	}
 	clearScreen();
 }
 
 /*
-All daily operations (performs water/rotation cycles at the proper intervals, and listening for buttons)
+Timer wheel of periodic jobs on the T1 clock
+Each job is linked into the slot of its deadline (deadline/WHEEL_TICK % WHEEL_SLOTS), so adding
+a job and expiring a slot take constant time; jobs more than one turn of the wheel away stay
+in their slot until their deadline comes round
+Jobs run one at a time on the main task, so two jobs never move the same bed at once
+*/
+typedef struct
+{
+	int numJobs;
+	int kind[MAX_JOBS]; //JOB_*
+	int bed[MAX_JOBS]; //bed the job works on
+	long period[MAX_JOBS];
+	long deadline[MAX_JOBS];
+	long lastRun[MAX_JOBS];
+	int priority[MAX_JOBS]; //PRIORITY_*
+	bool due[MAX_JOBS]; //expired, waiting to run
+	int next[MAX_JOBS]; //next job in the same slot, -1 at the end
+	int slot[WHEEL_SLOTS]; //first job in each slot, -1 if empty
+	long currentTick; //next tick to expire
+	tClockRules rules; //wall clock rules applied to every deadline
+} tScheduler;
+
+void initScheduler(tScheduler& scheduler, tClockRules& rules)
+{
+	memcpy(scheduler.rules, rules, sizeof(tClockRules));
+	scheduler.numJobs = 0;
+	scheduler.currentTick = time1[T1]/WHEEL_TICK;
+	for (int i = 0; i < WHEEL_SLOTS; i++)
+		scheduler.slot[i] = -1;
+}
+
+/*
+Links a job into the wheel, or marks it due if its deadline has already passed
+The deadline follows the job kind's wall clock rules (see clockRuleDeadline)
+*/
+void insertJob(tScheduler& scheduler, int job, long deadline)
+{
+	deadline = clockRuleDeadline(scheduler.rules, scheduler.kind[job], deadline);
+	scheduler.deadline[job] = deadline;
+	scheduler.due[job] = false;
+	if (deadline/WHEEL_TICK < scheduler.currentTick) //slot already expired
+		scheduler.due[job] = true;
+	else
+	{
+		int slot = (deadline/WHEEL_TICK) % WHEEL_SLOTS;
+		scheduler.next[job] = scheduler.slot[slot];
+		scheduler.slot[slot] = job;
+	}
+}
+
+/*
+Adds a periodic job for a bed whose first run is firstDelay ms from now
+Returns the job number, or -1 if the scheduler is full
+*/
+int addJob(tScheduler& scheduler, int kind, int bed, long period, long firstDelay, int priority)
+{
+	if (scheduler.numJobs == MAX_JOBS)
+		return -1;
+	int job = scheduler.numJobs;
+	scheduler.numJobs++;
+	scheduler.kind[job] = kind;
+	scheduler.bed[job] = bed;
+	scheduler.period[job] = period;
+	scheduler.lastRun[job] = time1[T1] + firstDelay - period;
+	scheduler.priority[job] = priority;
+	insertJob(scheduler, job, time1[T1] + firstDelay);
+	return job;
+}
+
+/*
+Marks the jobs of one slot whose deadline has passed as due
+*/
+void expireSlot(tScheduler& scheduler, long tick, long now)
+{
+	int slot = tick % WHEEL_SLOTS;
+	int previous = -1;
+	int job = scheduler.slot[slot];
+	while (job >= 0)
+	{
+		int next = scheduler.next[job];
+		if (scheduler.deadline[job] <= now)
+		{
+			if (previous < 0)
+				scheduler.slot[slot] = next;
+			else
+				scheduler.next[previous] = next;
+			scheduler.due[job] = true;
+		}
+		else
+			previous = job;
+		job = next;
+	}
+}
+
+/*
+Expires every slot up to the current time
+*/
+void advanceScheduler(tScheduler& scheduler)
+{
+	long now = time1[T1];
+	long nowTick = now/WHEEL_TICK;
+	while (scheduler.currentTick < nowTick)
+	{
+		expireSlot(scheduler, scheduler.currentTick, now);
+		scheduler.currentTick++;
+	}
+	expireSlot(scheduler, nowTick, now); //the current slot may fill up again
+}
+
+/*
+Returns the due job with the highest priority, or -1 if none
+Of equal priorities the job that has waited longest goes first, so the beds take turns
+*/
+int nextJob(tScheduler& scheduler)
+{
+	int best = -1;
+	for (int job = 0; job < scheduler.numJobs; job++)
+	{
+		if (scheduler.due[job] && (best < 0 || scheduler.priority[job] > scheduler.priority[best]
+			|| (scheduler.priority[job] == scheduler.priority[best] && scheduler.deadline[job] < scheduler.deadline[best])))
+			best = job;
+	}
+	return best;
+}
+
+/*
+Returns the earliest deadline of the jobs waiting in the wheel
+*/
+long nextDeadline(tScheduler& scheduler)
+{
+	long earliest = time1[T1] + WHEEL_TICK*WHEEL_SLOTS;
+	for (int job = 0; job < scheduler.numJobs; job++)
+	{
+		if (scheduler.due[job])
+			return time1[T1];
+		if (scheduler.deadline[job] < earliest)
+			earliest = scheduler.deadline[job];
+	}
+	return earliest;
+}
+
+void startJob(tScheduler& scheduler, int job)
+{
+	scheduler.due[job] = false;
+}
+
+/*
+Returns the T1 time the first zone of a bed is due for water (its last water plus its interval),
+or deadline if the bed has no zones
+*/
+long zoneDeadline(tBed& bed, long deadline)
+{
+	for (int zone = 0; zone < bed.numZones; zone++)
+	{
+		long due = bed.zoneLastWater[zone] + bed.zoneInterval[zone];
+		if (zone == 0 || due < deadline)
+			deadline = due;
+	}
+	return deadline;
+}
+
+/*
+Schedules the job's next run one period from now
+The water job of a bed with zones runs when its first zone is due instead (at least a wheel tick
+from now, so a zone that was not watered does not keep the job due)
+*/
+void finishJob(tScheduler& scheduler, int job, tGreenhouse& greenhouse)
+{
+	scheduler.lastRun[job] = time1[T1];
+	long deadline = scheduler.lastRun[job] + scheduler.period[job];
+	if (scheduler.kind[job] == JOB_WATER)
+	{
+		deadline = zoneDeadline(greenhouse.bed[scheduler.bed[job]], deadline);
+		deadline = max2(deadline, time1[T1] + WHEEL_TICK);
+	}
+	insertJob(scheduler, job, deadline);
+}
+
+/*
+Adds a bed's water and rotation jobs, resuming the intervals carried over from before a restart
+*/
+void scheduleBed(tScheduler& scheduler, tBed& bed, int bedNumber)
+{
+	for (int zone = 0; zone < bed.numZones; zone++)
+		bed.zoneLastWater[zone] = time1[T1] - bed.waterElapsed;
+	bed.waterJob = addJob(scheduler, JOB_WATER, bedNumber, bed.waterInterval, bed.waterInterval - bed.waterElapsed,
+		PRIORITY_HIGH);
+	bed.rotationJob = addJob(scheduler, JOB_ROTATE, bedNumber, bed.rotationInterval, bed.rotationInterval - bed.rotationElapsed,
+		PRIORITY_NORMAL);
+}
+
+/*
+Adapts an adaptive bed's water interval and dose (see adaptWatering); its water job runs at the new interval
+*/
+void adaptJob(tScheduler& scheduler, int job, tGreenhouse& greenhouse)
+{
+	int bedNumber = scheduler.bed[job];
+	if (scheduler.kind[job] != JOB_WATER || !greenhouse.bed[bedNumber].adaptive)
+		return;
+	adaptWatering(greenhouse, greenhouse.bed[bedNumber]);
+	scheduler.period[job] = greenhouse.bed[bedNumber].waterInterval;
+}
+
+/*
+Runs a water or rotation job on its bed
+Returns false if fails
+*/
+bool runJob(tScheduler& scheduler, int job, tBed& bed, int& taskFailed)
+{
+	bool executed = true;
+	switch (scheduler.kind[job])
+	{
+		case JOB_WATER:
+			executed = waterBed(bed, false, taskFailed);
+			break;
+		case JOB_ROTATE:
+			executed = rotateGreenhouse(bed, taskFailed);
+			bed.rotationCycles++; //counts the turn if one was needed
+			break;
+		default:
+			break;
+	}
+	return executed;
+}
+
+/*
+Records the time since the bed's last water and rotation cycles and its light exposure, for the checkpoint
+*/
+void updateElapsed(tScheduler& scheduler, tBed& bed)
+{
+	updateExposure(bed);
+	bed.waterElapsed = time1[T1] - scheduler.lastRun[bed.waterJob];
+	bed.rotationElapsed = time1[T1] - scheduler.lastRun[bed.rotationJob];
+}
+
+/*
+Returns how often the motors of every bed have moved (pump cycles and turns), so a job that moved
+nothing (a checkpoint, telemetry, a balanced rotation) is not taken as activity
+*/
+long greenhouseMotions(tGreenhouse& greenhouse)
+{
+	long motions = 0;
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		motions += greenhouse.bed[i].pumpCycles + greenhouse.bed[i].turnCycles;
+	return motions;
+}
+
+/*
+All daily operations (performs water/rotation cycles of every bed at the proper intervals, and listening for buttons)
 */
 void activateGreenhouse(string& plantName, bool& executed, int& taskFailed, float& waterInterval, float& rotationInterval,
-float& day, float& month, float& year, float& hour, float& minute, float& period, float& newHour, float& newMinute)
+float& day, float& month, float& year, float& hour, float& minute, float& period, float& newHour, float& newMinute,
+tCheckpoint& checkpoint, tGreenhouse& greenhouse)
 {
-	clearTimer(T2); //water cycle interval timer
-	clearTimer(T3); //rotation interval timer
-	
-	// initialize, for the multiplexer connected to S4; must be done here (not global)
-	MSMMUXinit();
-	wait1Msec(50);
+	//periodic jobs, interleaved across the beds
+	tScheduler scheduler;
+	initScheduler(scheduler, greenhouse.rules);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+	{
+		if (greenhouse.bed[i].adaptive)
+			adaptWatering(greenhouse, greenhouse.bed[i]);
+		scheduleBed(scheduler, greenhouse.bed[i], i);
+	}
+	addJob(scheduler, JOB_CHECKPOINT, 0, CHECKPOINT_INTERVAL, CHECKPOINT_INTERVAL, PRIORITY_LOW);
+	addJob(scheduler, JOB_TELEMETRY, 0, TELEMETRY_INTERVAL, 0, PRIORITY_LOW);
 	
 	/*
  	buttonUp: stats report
   	buttonDown: shut down
 	*/
 
-	int numRotations = 0; //no turns yet
-	bool clockwise = true; //first turn clockwise
 	bool userShutDown = false; //to exit activateGreenhouse without failing
+	long lastActivity = time1[T1]; //last button press or job that moved a motor, for idling
 	
-	while(executed && !userShutDown)
+	while(executed && !userShutDown && !watchdogTripped)
 	{
-		displayTextLine(4, "Press UP for stats");
-		displayTextLine(5, "Press DOWN to shut down");
+		showLine(4, "Press UP for stats");
+		showLine(5, "Press DOWN to shut down");
 
-		//listens for button presses, waits for timers
-		while (!getButtonPress(buttonUp) && !getButtonPress(buttonDown) && (time1[T2] < waterInterval)
-			&& (time1[T3] < rotationInterval) && (SensorValue[S3] == 0))
-		{}
+		//listens for button presses, waits (idling if it is a while) for the next job
+		//(waking for the wheel or a job is not activity, only a button or motors moving are)
+		idleWait(greenhouse, nextDeadline(scheduler), lastActivity);
+		if (getButtonPress(buttonAny))
+			lastActivity = time1[T1];
+		advanceScheduler(scheduler);
+		int job = nextJob(scheduler);
 
 		//EMERGENCY SHUT-DOWN
-		if (SensorValue[S3] == 1)
+		if (SensorValue[S3] == 1 || emergencyStopped)
 			executed = false;
 
 		//GENERATE STATS (up button)
 		else if (getButtonPress(buttonUp))
 		{
 			while(getButtonPress(buttonAny))
-			{}
+			{
+				kickWatchdog(STALL_BUTTON);
+			}
 			wait1Msec(50); //buffer
 			clearScreen();
 			generateStats(plantName, waterInterval, rotationInterval, day, month, year, hour,
-				minute, period, newHour, newMinute, executed, taskFailed);
+				minute, period, newHour, newMinute, executed, taskFailed, checkpoint, greenhouse);
 		}
 	
 		//NORMAL SHUT DOWN (down button)
 		else if (getButtonPress(buttonDown))
 		{
 			while(getButtonPress(buttonAny))
-			{}
+			{
+				kickWatchdog(STALL_BUTTON);
+			}
 			wait1Msec(50); //buffer
 			userShutDown = true;
+			fileDelete(CHECKPOINT_FILE); //next start is a new schedule
 		}
-	
-		//WATER CYCLE (time based)
-		else if (time1[T2] > waterInterval)
+
+		//SCHEDULED JOBS (time based)
+		else if (job >= 0)
 		{
-			if (activateWaterCycle(taskFailed))
-			{
-				executed = resetWaterCycle(taskFailed);
-				clearTimer(T2);
-			}
+			kickWatchdog(STALL_JOB);
+			startJob(scheduler, job);
+			long motions = greenhouseMotions(greenhouse);
+			if (scheduler.kind[job] == JOB_TELEMETRY) //needs every bed
+				writeTelemetry(checkpoint, greenhouse);
 			else
-				executed = false;
-		}
-	
-		//ROTATION (time based)
-		else if (time1[T3] > rotationInterval)
-		{
-			executed = rotateGreenhouse(numRotations, clockwise, taskFailed);
-			clearTimer(T3);
+				executed = runJob(scheduler, job, greenhouse.bed[scheduler.bed[job]], taskFailed);
+			if (!executed)
+				greenhouse.failedBed = scheduler.bed[job];
+			adaptJob(scheduler, job, greenhouse); //before the next run is scheduled
+			finishJob(scheduler, job, greenhouse);
+			if (greenhouseMotions(greenhouse) != motions)
+				lastActivity = time1[T1];
+
+			//save after every job, so a restart does not repeat a cycle
+			for (int i = 0; i < greenhouse.numBeds; i++)
+				updateElapsed(scheduler, greenhouse.bed[i]);
+			saveCheckpoint(checkpoint, greenhouse);
 		}
 	}
+	if (watchdogTripped)
+	{
+		executed = false;
+		taskFailed = WATCHDOG_FAILED;
+	}
 }
 
 void safeShutDown(string plantName, float waterInterval, float rotationInterval, float day, float month, float year,
-float hour, float minute, float period, float newHour, float newMinute, int taskFailed, bool executed)
+float hour, float minute, float period, float newHour, float newMinute, int taskFailed, bool executed,
+tCheckpoint& checkpoint, tGreenhouse& greenhouse)
 {
-	motor[motorD] = 0; //stop pump
-	MSMotorStop(mmotor_S1_1); //stop rotation
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		stopBed(greenhouse.bed[i]); //stop pump, axis and rotation
+	watchdogArmed = false; //nothing moves from here on
+	finishTrace();
+	writeCoverage(greenhouse);
 	clearScreen();
 	generateStats(plantName, waterInterval, rotationInterval, day, month, year, hour, minute, period, newHour,
-		newMinute, executed, taskFailed);
+		newMinute, executed, taskFailed, checkpoint, greenhouse);
 }
 
+#ifdef ESTOP_BENCHMARK
+/*
+Runs the phase of a bed that kicks the watchdog at stallPoint, with the emergency stop set to be
+injected there (see kickWatchdog); phases that need more than the bed can give (a held button, an
+empty tank, zones) prompt for it or are not reached
+Returns false if the phase moved the bed, which then has to be put back by hand
+*/
+bool runStopPhase(tGreenhouse& greenhouse, tBed& bed, int stallPoint, int& taskFailed)
+{
+	if (stallPoint == STALL_IDLE)
+		idleWait(greenhouse, estopTestAfter + ESTOP_BENCH_PHASE_TIME, time1[T1] - IDLE_DELAY); //low-power idle
+	else if (stallPoint == STALL_REFILL && !tankWater[bed.fillSensor]) //only with an empty tank
+		waitForWater(bed.fillSensor);
+	else if (stallPoint == STALL_MESSAGE) //kicks once, when the message goes up
+	{
+		while (time1[T1] < estopTestAfter)
+			wait1Msec(1);
+		waitMessage();
+	}
+	else if (stallPoint == STALL_BUTTON)
+	{
+		showLine(3, "Press and hold ENTER");
+		while (!getButtonPress(buttonEnter))
+			wait1Msec(10);
+		while (getButtonPress(buttonAny) && !emergencyStopped)
+			kickWatchdog(STALL_BUTTON);
+		showLine(3, "");
+	}
+	else if (stallPoint == STALL_JOB || stallPoint == STALL_ROTATE)
+	{
+		int orientation = bed.orientation;
+		bed.faceExposure[faceOf(bed.orientation)] += 2*EXPOSURE_BALANCE; //makes the bed turn
+		if (stallPoint == STALL_JOB) //kicks once, when the job starts
+		{
+			while (time1[T1] < estopTestAfter)
+				wait1Msec(1);
+			kickWatchdog(STALL_JOB);
+		}
+		rotateGreenhouse(bed, taskFailed);
+		bed.orientation = orientation; //put back by hand before the next stop
+		return false;
+	}
+	else if (stallPoint == STALL_RESET)
+	{
+		int armedPoint = estopTestPoint;
+		estopTestPoint = STALL_NONE; //out and back, stopped on the way back
+		activateWaterCycle(bed, taskFailed);
+		estopTestPoint = armedPoint;
+		resetWaterCycle(bed, taskFailed);
+		return false;
+	}
+	else if (stallPoint == STALL_WATER || stallPoint == STALL_Y_AXIS)
+	{
+		activateWaterCycle(bed, taskFailed);
+		return false;
+	}
+	else if (stallPoint == STALL_ZONE && bed.numZones > 0)
+	{
+		waterZones(bed, true, taskFailed);
+		return false;
+	}
+	return true;
+}
+
+/*
+Emergency stop benchmark (ESTOP_BENCHMARK build): for every stall point, runs its phase
+ESTOP_BENCH_TRIALS times with a press injected into it, each later into the phase, and takes the
+worst time from the press to the end of the last stop write (detection delay and bus waits included)
+After a phase that moved the bed, asks for it to be put back before the next stop
+Shows the worst case per stall point and writes them to ESTOP_FILE (-1: the phase was not reached)
+*/
+void benchmarkEmergencyStop(tGreenhouse& greenhouse)
+{
+	long worst[STALL_POINTS];
+	long overall = 0;
+	int taskFailed = NO_FAILURE;
+	char text[DISPLAY_TEXT_SIZE];
+	for (int point = STALL_IDLE; point < STALL_POINTS; point++)
+	{
+		worst[point] = -1;
+		for (int trial = 0; trial < ESTOP_BENCH_TRIALS; trial++)
+		{
+			sprintf(text, "E-stop test %d/%d", point, trial + 1);
+			showLine(3, text);
+			estopTestAfter = time1[T1] + ESTOP_BENCH_DELAY*(trial + 1);
+			estopTestPoint = point;
+			long stops = estopStops;
+			bool inPlace = runStopPhase(greenhouse, greenhouse.bed[0], point, taskFailed);
+			estopTestPoint = STALL_NONE;
+			if (estopTestPress < 0) //phase over before the press
+				break;
+			while (estopStops == stops)
+				wait1Msec(1);
+			if (estopLatency > worst[point])
+				worst[point] = estopLatency;
+			for (int i = 0; i < greenhouse.numBeds; i++)
+				stopBed(greenhouse.bed[i]); //the actuators know their motors are off
+			estopTestPress = -1; //released before the stop task starts again
+			emergencyStopped = false; //unlatched for the next stop (benchmark only)
+			startTask(emergencyStopTask, kHighPriority);
+			if (!inPlace)
+			{
+				showLine(4, "Put the bed back,");
+				showLine(5, "then press ENTER");
+				while (!getButtonPress(buttonEnter))
+					wait1Msec(10);
+				while (getButtonPress(buttonAny))
+					wait1Msec(10);
+				showLine(4, "");
+				showLine(5, "");
+			}
+		}
+		overall = max2(overall, worst[point]);
+	}
+
+	long fileHandle = fileOpenWrite(ESTOP_FILE);
+	for (int point = STALL_IDLE; point < STALL_POINTS; point++)
+	{
+		sprintf(text, "stall point %d: %d ms\n", point, worst[point]);
+		if (fileHandle >= 0)
+			fileWriteData(fileHandle, text, strlen(text));
+	}
+	if (fileHandle >= 0)
+		fileClose(fileHandle);
+	clearScreen();
+	for (int point = STALL_IDLE; point < STALL_POINTS; point++)
+	{
+		sprintf(text, "Point %d: %d ms", point, worst[point]);
+		showLine(3 + (point - STALL_IDLE) % 5, text);
+		if ((point - STALL_IDLE) % 5 == 4 || point == STALL_POINTS - 1)
+		{
+			waitMessage();
+			clearScreen();
+			showLine(7, "");
+		}
+	}
+	sprintf(text, "Worst E-stop: %d ms", overall);
+	showLine(3, text);
+	while (!getButtonPress(buttonAny))
+		wait1Msec(10);
+}
+#endif
+
 task main()
 {
 	/*
@@ -524,6 +4307,8 @@ task main()
    	waterTiming: time in between water cycles (milliseconds)
     	rotationTiming: time in between rotation cycles (milliseconds)
      	day, month, year: today's date (##, ##, ####)
+	plantPreset: PRESET_SUCCULENT, PRESET_FERN, PRESET_HERB or PRESET_FLOWER sets the intervals,
+		dose and coverage in one step (PRESET_NONE: the timings above, full dose and coverage)
  	*/
 	
 	string plantName = " ";
@@ -532,14 +4317,45 @@ task main()
 	float day = 0;
 	float month = 0;
 	float year = 0;
+	int plantPreset = PRESET_NONE;
 	
 	/*
  	END OF USER SETTINGS
+	(any setting in greenhouse.cfg replaces these, see loadConfig)
   	*/
+	startDisplay(); //all screen output goes through the display model
+	float startHour = 0;
+	float startMinute = 0;
+	float startPeriod = 0;
+	tGreenhouse greenhouse;
+	initGreenhouse(greenhouse);
+	bool timeLoaded = loadConfig(plantName, waterTiming, rotationTiming, day, month, year,
+		startHour, startMinute, startPeriod, plantPreset, greenhouse);
+	applyPlantPreset(greenhouse, plantPreset, waterTiming, rotationTiming);
+	applyUserSettings(greenhouse, plantName, waterTiming, rotationTiming);
+	loadCalibration(greenhouse); //measured travel and fail-safe times
 	
 	clearTimer(T1); //main timer
-	configureSensors();
-	MSMotorStop(mmotor_S1_1); //precaution for multiplexer motor
+	startBatteryLevel = nAvgBatteryLevel;
+	startTrace();
+	configureSensors(greenhouse);
+	if (getButtonPress(buttonRight)) //hold RIGHT while starting to calibrate the tank gauges
+		calibrateTankGauges(greenhouse);
+	else
+		loadTankGauges();
+	startWaterLevelService(greenhouse);
+	initMultiplexers(greenhouse); //applies the tuned rotation gains
+	startEmergencyStop(greenhouse);
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		driveActuator(greenhouse.bed[i].rotation, 0); //precaution for multiplexer motors
+	if (getButtonPress(buttonLeft)) //hold LEFT while starting to calibrate
+		calibrateGreenhouse(greenhouse);
+	if (getButtonPress(buttonUp)) //hold UP while starting to tune the rotation
+		tuneGreenhouse(greenhouse);
+#ifdef ESTOP_BENCHMARK
+	benchmarkEmergencyStop(greenhouse); //instead of the schedule
+	return;
+#endif
 
 	bool executed = true; //false as soon as any function fails
 	int taskFailed = NO_FAILURE; //indicates which task failed
@@ -550,27 +4366,81 @@ task main()
     	settings[5]: start hour		settings[6]: start minute
 	settings[7]: am = 1, pm = 0	settings[8]: current hour	settings[9]: current minute
     	*/
-	float settings[10] = {waterTiming, rotationTiming, day, month, year, 0, 0, 0, 0, 0};
+	float settings[10] = {waterTiming, rotationTiming, day, month, year, startHour, startMinute, startPeriod, 0, 0};
+
+	/*
+	Resume the saved schedule after a restart (hold DOWN while starting for a new setup,
+	ENTER to correct the time of day of the resumed schedule)
+	*/
+	tCheckpoint checkpoint;
+	initCheckpoint(checkpoint);
+	bool timeReset = getButtonPress(buttonEnter);
+	bool resumed = !getButtonPress(buttonDown) && loadCheckpoint(checkpoint, greenhouse);
+
+	if (resumed)
+	{
+		for (int i = 2; i < 10; i++) //keep the intervals entered above
+			settings[i] = checkpoint.settings[i];
+		showLine(3, "Resuming schedule");
+		waitMessage();
+		clearScreen();
+	}
+	else
+	{
+		initCheckpoint(checkpoint);
+		if (!timeLoaded)
+			setStartTime(settings[5], settings[6], settings[7], 0); //user inputs current time
+	}
+	for (int i = 0; i < 10; i++)
+		checkpoint.settings[i] = settings[i];
+	setClock(settings[5], settings[6], settings[7], checkpoint.runTime);
+	if (resumed)
+	{
+		clockStart = checkpoint.clockStart; //carries on from the saved clock, without waiting for input
+		if (timeReset)
+		{
+			long held = time1[T1];
+			while (getButtonPress(buttonAny) && time1[T1] - held < TIME_RESET_TIMEOUT) //ENTER held while starting
+			{}
+			long now = wallClock() % DAY_LENGTH; //the saved clock is the starting point
+			float hour = (now/3600000) % 12;
+			float minute = (now/60000) % 60;
+			float period = (now >= DAY_LENGTH/2) ? 1 : 0;
+			if (hour == 0)
+				hour = 12;
+			if (setStartTime(hour, minute, period, TIME_RESET_TIMEOUT)) //keeps the saved clock if left alone
+				setClockNow(hour, minute, period);
+		}
+	}
+	for (int i = 0; i < greenhouse.numBeds; i++)
+		greenhouse.bed[i].exposureClock = wallClock(); //time switched off is not counted
 
-	setStartTime(settings[5], settings[6], settings[7]); //user inputs current time
 	generateStats(plantName, settings[0], settings[1], settings[2], settings[3], settings[4], settings[5],
-		settings[6], settings[7], settings[8], settings[9], executed, taskFailed);
+		settings[6], settings[7], settings[8], settings[9], executed, taskFailed, checkpoint, greenhouse);
+
+	armWatchdog(); //motion from here on must keep kicking it
 
 	/*
- 	First water-cycle (start-up)
+ 	First water-cycle of each bed (start-up, not repeated when resuming)
  	*/
-	if (activateWaterCycle(taskFailed))
-		executed = resetWaterCycle(taskFailed);
-	else
-		executed = false;
+	for (int i = 0; i < greenhouse.numBeds && executed && !resumed; i++)
+	{
+		executed = waterBed(greenhouse.bed[i], true, taskFailed); //intervals start after the start-up cycle
+		if (!executed)
+			greenhouse.failedBed = i;
+	}
+	if (watchdogTripped)
+		taskFailed = WATCHDOG_FAILED;
+	if (executed && !resumed)
+		saveCheckpoint(checkpoint, greenhouse);
 
 	/*
  	Main program operations
 	*/
 	if (executed)
 		activateGreenhouse(plantName, executed, taskFailed, settings[0], settings[1], settings[2],
-			settings[3], settings[4], settings[5], settings[6], settings[7], settings[8], settings[9]);
+			settings[3], settings[4], settings[5], settings[6], settings[7], settings[8], settings[9], checkpoint, greenhouse);
 
 	safeShutDown(plantName, settings[0], settings[1], settings[2], settings[3], settings[4],
-		settings[5], settings[6], settings[7], settings[8], settings[9], taskFailed, executed);
+		settings[5], settings[6], settings[7], settings[8], settings[9], taskFailed, executed, checkpoint, greenhouse);
 }
@@ -0,0 +1,106 @@
+/*
+Host microbenchmark: the zero-copy tokeniser in common.h (tokenInit/tokenNext) against the
+deprecated strtok, on config lines like the ones loadConfig reads
+
+The tokeniser section of common.h is extracted as is (RobotC-only code around it is left out)
+and compiled with the shims below, so the benchmark always measures the code on the brick
+Build and run from the repository root:
+	sed -n '/^#define STRTOK_MAX_TOKEN_SIZE/,/^typedef enum tXButton/p' common.h | sed '$d' > /tmp/tokeniser.h
+	g++ -O2 -I/tmp -o /tmp/tokeniser-bench benchmarks/tokeniser-bench.cpp
+	/tmp/tokeniser-bench
+
+strtok only runs on the short line: lines of STRTOK_MAX_BUFFER_SIZE (50) bytes or more overflow
+its temporary buffer, which is one of the reasons it is deprecated
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+//RobotC shims
+#define min2(a, b) (a < b ? a : b)
+
+short stringFind(char* buffer, char* text)
+{
+	char* found = std::strstr(buffer, text);
+	if (found == NULL)
+		return -1;
+	return (short)(found - buffer);
+}
+
+#include "tokeniser.h"
+
+const long ITERATIONS = 1000000;
+const int LINE_SIZE = 160;
+
+//short enough for strtok (under STRTOK_MAX_BUFFER_SIZE bytes, tokens under STRTOK_MAX_TOKEN_SIZE)
+const char SHORT_LINE[] = "bed Basil S2_1 A B - S2_2 2 3600000 7200000";
+//a full zone and bed setting, longer than strtok can take
+const char LONG_LINE[] = "bed Greenhouse_North_Basil S2_1 A B S4_2 S2_2 2 3600000.5 7200000.25 "
+	"zone 2 150 900 300 1200 45000 80 # watered every hour, pump at 80%";
+
+volatile long sink = 0; //keeps the work from being optimised away
+
+/*
+Returns the ns per line, and the number of tokens per line in tokens
+*/
+double benchStrtok(const char* text, int& tokens)
+{
+	char line[STRTOK_MAX_BUFFER_SIZE];
+	char token[STRTOK_MAX_TOKEN_SIZE];
+	char seperator[] = " ";
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < ITERATIONS; i++)
+	{
+		std::strcpy(line, text);
+		tokens = 0;
+		while (strtok(line, token, seperator))
+		{
+			tokens++;
+			sink += token[0];
+		}
+	}
+	std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+	return time.count()/ITERATIONS;
+}
+
+double benchCursor(const char* text, int& tokens)
+{
+	char line[LINE_SIZE];
+	short length = (short)std::strlen(text);
+	std::strcpy(line, text);
+	tTokenCursor cursor;
+	tToken token;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < ITERATIONS; i++)
+	{
+		tokenInit(cursor, line, length);
+		tokens = 0;
+		while (tokenNext(cursor, token, ' '))
+		{
+			tokens++;
+			sink += line[token.start];
+		}
+	}
+	std::chrono::duration<double, std::nano> time = std::chrono::steady_clock::now() - start;
+	return time.count()/ITERATIONS;
+}
+
+int main()
+{
+	int strtokTokens = 0;
+	int cursorTokens = 0;
+	double strtokTime = benchStrtok(SHORT_LINE, strtokTokens);
+	double cursorTime = benchCursor(SHORT_LINE, cursorTokens);
+	std::printf("short line (%d bytes): strtok %.1f ns (%d tokens), tokenNext %.1f ns (%d tokens), %.1fx\n",
+		(int)std::strlen(SHORT_LINE), strtokTime, strtokTokens, cursorTime, cursorTokens, strtokTime/cursorTime);
+	if (strtokTokens != cursorTokens)
+	{
+		std::printf("token counts differ\n");
+		return 1;
+	}
+
+	cursorTime = benchCursor(LONG_LINE, cursorTokens);
+	std::printf("long line (%d bytes): strtok n/a (overflows), tokenNext %.1f ns (%d tokens)\n",
+		(int)std::strlen(LONG_LINE), cursorTime, cursorTokens);
+	return 0;
+}
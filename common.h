@@ -47,6 +47,9 @@
  *         Changed clearI2CError to take ubyte for address, thanks Aswin
  * - 0.15: Removed motor mux and sensor mux functions and types out
  * - 0.16: Added max() and min() functions by Mike Henning, Max Bareiss
+ * - 0.17: Added __COMMON_H_TRACE__ hook to trace I2C command frames
+ * - 0.18: Added zero-copy tokeniser (tTokenCursor, tokenNext() and friends), strtok() is deprecated
+ * - 0.19: Added per-port priority I2C transactions (tI2CTransaction, writeI2CQueued())
  *
  * \author Xander Soldaat (xander_at_botbench.com)
  * \date 27 April 2011
@@ -176,6 +179,14 @@ bool waitForI2CBus(tSensors link);
 bool writeI2C(tSensors link, tByteArray &request, tByteArray &reply, short replylen);
 bool writeI2C(tSensors link, tByteArray &request);
 
+#ifdef __COMMON_H_TRACE__
+/**
+ * Called for every I2C command frame sent with writeI2C(link, request).
+ * Must be provided by the program that defines __COMMON_H_TRACE__.
+ */
+void traceI2CFrame(tSensors link, tByteArray &request);
+#endif // __COMMON_H_TRACE__
+
 /**
  * Clear out the error state on I2C bus by sending a bunch of dummy
  * packets.
@@ -470,6 +481,10 @@ bool writeI2C(tSensors link, tByteArray &request) {
   }
 #endif // __COMMON_H_SENSOR_CHECK__
 
+#ifdef __COMMON_H_TRACE__
+  traceI2CFrame(link, request);
+#endif // __COMMON_H_TRACE__
+
   sendI2CMsg(link, &request[0], 0);
 
   if (!waitForI2CBus(link)) {
@@ -572,6 +587,88 @@ bool writeI2C(tSensors link, tByteArray &request, tByteArray &reply, short reply
 }
 
 
+#define I2C_PRIO_SAFETY     0  /*!< Safety stop commands, always next on the bus */
+#define I2C_PRIO_ENCODER    1  /*!< Time critical encoder polls */
+#define I2C_PRIO_STATUS     2  /*!< Status reads, commands and configuration */
+#define I2C_PRIO_TELEMETRY  3  /*!< Anything that can wait */
+#define I2C_PRIO_CLASSES    4  /*!< Number of priority classes */
+
+/**
+ * An I2C transaction with its own buffers, so several tasks can use the bus at once
+ */
+typedef struct
+{
+  tByteArray request;   /*!< Data to be sent, request[0] is the message size */
+  tByteArray reply;     /*!< Array to hold received data */
+  short replyLen;       /*!< Number of bytes expected in reply, 0 for none */
+  ubyte priority;       /*!< Priority class, one of I2C_PRIO_* */
+} tI2CTransaction;
+
+bool I2CPortBusy[4];                          /*!< A transaction is on the bus of this port */
+long I2CNextTicket[4][I2C_PRIO_CLASSES];      /*!< Next ticket to hand out, per port and class */
+long I2CServing[4][I2C_PRIO_CLASSES];         /*!< Ticket being served, per port and class */
+
+/**
+ * Check whether a more urgent class has a transaction waiting on a port
+ * @param link the port number
+ * @param priority the priority class to compare with
+ * @return true if a more urgent transaction is waiting
+ */
+bool I2CUrgentWaiting(tSensors link, ubyte priority)
+{
+  for (short i = 0; i < priority; i++)
+  {
+    if (I2CNextTicket[link][i] != I2CServing[link][i])
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Write a transaction to the I2C bus, waiting for its turn on the port.  The bus goes
+ * to the most urgent class first and to transactions of the same class in order,
+ * so a safety stop waits for at most the one transaction already on the bus.
+ * @param link the port number
+ * @param transaction the transaction, the reply (if any) is stored in it
+ * @return true if no error occured, false if it did
+ */
+bool writeI2CQueued(tSensors link, tI2CTransaction &transaction)
+{
+  ubyte priority = transaction.priority;
+  bool success = false;
+
+  hogCPU();
+  long ticket = I2CNextTicket[link][priority];
+  I2CNextTicket[link][priority]++;
+  releaseCPU();
+
+  // Wait for a free bus, our turn in our class and no more urgent class waiting
+  while (true)
+  {
+    hogCPU();
+    if (!I2CPortBusy[link] && (I2CServing[link][priority] == ticket) && !I2CUrgentWaiting(link, priority))
+    {
+      I2CPortBusy[link] = true;
+      releaseCPU();
+      break;
+    }
+    releaseCPU();
+    abortTimeslice();
+  }
+
+  if (transaction.replyLen > 0)
+    success = writeI2C(link, transaction.request, transaction.reply, transaction.replyLen);
+  else
+    success = writeI2C(link, transaction.request);
+
+  hogCPU();
+  I2CServing[link][priority]++;
+  I2CPortBusy[link] = false;
+  releaseCPU();
+
+  return success;
+}
+
 /**
  * Create a unique ID (UID) for an NXT.  This based on the last 3 bytes
  * of the Bluetooth address.  The first 3 bytes are manufacturer
@@ -595,7 +692,10 @@ long getUID() {
 #define STRTOK_MAX_BUFFER_SIZE 50
 
 /**
- * Tokenise an array of chars, using a seperator
+ * Tokenise an array of chars, using a seperator.
+ *
+ * Deprecated: this copies the rest of the buffer for every token and is limited to
+ * STRTOK_MAX_BUFFER_SIZE byte buffers, use tokenInit() and tokenNext() instead.
  * @param buffer pointer to buffer we're parsing
  * @param token pointer to buffer to hold the tokens as we find them
  * @param seperator the seperator used between tokens
@@ -639,6 +739,157 @@ bool strtok(char *buffer, char *token, char *seperator)
   return false;
 }
 
+/**
+ * Cursor for tokenising a buffer in place.  The buffer is never copied or modified,
+ * tokens are returned as slices of it, so it must stay valid while the tokens are used.
+ */
+typedef struct
+{
+  char *buffer;   /*!< Buffer being parsed */
+  short length;   /*!< Number of chars in the buffer */
+  short pos;      /*!< Position of the next char to be parsed */
+} tTokenCursor;
+
+/**
+ * A token, a slice of the buffer of a tTokenCursor
+ */
+typedef struct
+{
+  short start;    /*!< Position of the first char in the buffer */
+  short length;   /*!< Number of chars in the token */
+} tToken;
+
+/**
+ * Start tokenising a buffer
+ * @param cursor the cursor to initialise
+ * @param buffer pointer to buffer we're parsing
+ * @param length number of chars in the buffer, parsing also stops at a 0 char
+ */
+void tokenInit(tTokenCursor &cursor, char *buffer, short length)
+{
+  cursor.buffer = buffer;
+  cursor.length = length;
+  cursor.pos = 0;
+}
+
+/**
+ * Find the next token.  Runs of seperators are skipped, so there are no empty tokens.
+ * @param cursor the cursor of the buffer we're parsing
+ * @param token the slice of the buffer holding the token we found
+ * @param seperator the seperator used between tokens
+ * @return true if a token was found, false if we're done
+ */
+bool tokenNext(tTokenCursor &cursor, tToken &token, char seperator)
+{
+  while ((cursor.pos < cursor.length) && (cursor.buffer[cursor.pos] == seperator))
+    cursor.pos++;
+
+  token.start = cursor.pos;
+  while ((cursor.pos < cursor.length) && (cursor.buffer[cursor.pos] != seperator) && (cursor.buffer[cursor.pos] != 0))
+    cursor.pos++;
+  token.length = cursor.pos - token.start;
+
+  // Stop for good at the end of a 0 terminated string
+  if ((cursor.pos < cursor.length) && (cursor.buffer[cursor.pos] == 0))
+    cursor.length = cursor.pos;
+
+  return (token.length > 0);
+}
+
+/**
+ * Compare a token with a 0 terminated string
+ * @param cursor the cursor the token was found with
+ * @param token the token
+ * @param text the string to compare with
+ * @return true if they are the same
+ */
+bool tokenEquals(tTokenCursor &cursor, tToken &token, const char *text)
+{
+  for (short i = 0; i < token.length; i++)
+  {
+    if (cursor.buffer[token.start + i] != text[i])
+      return false;
+  }
+  return (text[token.length] == 0);
+}
+
+/**
+ * Convert a token to a whole number, parsing stops at the first char that is not a digit
+ * @param cursor the cursor the token was found with
+ * @param token the token
+ * @return the number, 0 if the token doesn't start with one
+ */
+long tokenToLong(tTokenCursor &cursor, tToken &token)
+{
+  long result = 0;
+  short i = 0;
+  bool negative = (token.length > 0) && (cursor.buffer[token.start] == '-');
+
+  if (negative)
+    i++;
+  for (; i < token.length; i++)
+  {
+    char ch = cursor.buffer[token.start + i];
+    if ((ch < '0') || (ch > '9'))
+      break;
+    result = (result * 10) + (ch - '0');
+  }
+  return negative ? -result : result;
+}
+
+/**
+ * Convert a token to a float, parsing stops at the first char that is not part of the number
+ * @param cursor the cursor the token was found with
+ * @param token the token
+ * @return the number, 0 if the token doesn't start with one
+ */
+float tokenToFloat(tTokenCursor &cursor, tToken &token)
+{
+  float result = 0;
+  float scale = 1;
+  bool fraction = false;
+  short i = 0;
+  bool negative = (token.length > 0) && (cursor.buffer[token.start] == '-');
+
+  if (negative)
+    i++;
+  for (; i < token.length; i++)
+  {
+    char ch = cursor.buffer[token.start + i];
+    if ((ch == '.') && !fraction)
+      fraction = true;
+    else if ((ch >= '0') && (ch <= '9'))
+    {
+      if (fraction)
+      {
+        scale /= 10;
+        result += (ch - '0') * scale;
+      }
+      else
+        result = (result * 10) + (ch - '0');
+    }
+    else
+      break;
+  }
+  return negative ? -result : result;
+}
+
+/**
+ * Copy a token into a 0 terminated string, for when it has to outlive the buffer
+ * @param cursor the cursor the token was found with
+ * @param token the token
+ * @param dest buffer to copy the token into
+ * @param size size of dest, longer tokens are cut off
+ * @return the number of chars copied
+ */
+short tokenCopy(tTokenCursor &cursor, tToken &token, char *dest, short size)
+{
+  short length = min2(token.length, size - 1);
+  memcpy(dest, cursor.buffer + token.start, length);
+  dest[length] = 0;
+  return length;
+}
+
 typedef enum tXButton
 {
 #if defined(EV3)
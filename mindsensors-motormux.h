@@ -14,6 +14,15 @@
  *
  * Changelog:
  * - 0.1: Initial release
+ * - 0.2: Each call uses its own tI2CTransaction through writeI2CQueued(), stop commands
+ *        go out with I2C_PRIO_SAFETY and encoder reads with I2C_PRIO_ENCODER
+ * - 0.3: Added reentrant variants that take a caller-owned (or pooled) request frame,
+ *        frames are no longer cleared with memset before every call
+ * - 0.4: Added batched commands: stage several channels with MSMMUXbatchMotor() and
+ *        start them together with MSMMUXbatchCommit(), added MSMotorStopBoth()
+ * - 0.5: MSMMotorSetSpeedCtrl() now actually turns speed control off when asked to
+ * - 0.6: MSMMUXbatchMotor() ignores channels 3 and 4 instead of staging them over the next port's entries
+ * - 0.7: Removed the shared request frame pool, every caller owns its frames
  *
  * Credits:
  * - Big thanks to Mindsensors for providing me with the hardware necessary to write and test this.
@@ -112,25 +121,45 @@ typedef struct
   tMMUXData MMUXData;
 } tMSMMUX, *tMSMMUXPtr;
 
-tByteArray MSMMUX_I2CRequest;    /*!< Array to hold I2C command data */
-tByteArray MSMMUX_I2CReply;      /*!< Array to hold I2C reply data */
+/*!< Motor settings staged for a simultaneous start, one entry per MUX channel */
+typedef struct
+{
+  ubyte staged[4];          /*!< Bit mask of the channels staged on each sensor port */
+  long setpoint[8];         /*!< Encoder target, indexed by port * 2 + channel */
+  byte speed[8];            /*!< Motor power */
+  ubyte seconds[8];         /*!< Time target */
+  ubyte commandA[8];        /*!< Command A flags, without MSMMUX_CMD_GO */
+} tMSMMUXBatch;
 
 // Function prototypes
 void MSMMUXinit();
 bool MSMMUXreadStatus(tMUXmotor muxmotor, ubyte &motorStatus);
+bool MSMMUXreadStatus(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte &motorStatus, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMUXsendCommand(tSensors link, ubyte channel, long setpoint, byte speed, ubyte seconds, ubyte commandA, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMMUXsendCommand(tI2CTransaction &frame, tSensors link, ubyte channel, long setpoint, byte speed, ubyte seconds, ubyte commandA, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMUXsendCommand(tSensors link, ubyte command, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMMUXsendCommand(tI2CTransaction &frame, tSensors link, ubyte command, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMUXsetPID(tSensors link, unsigned short kpTacho, unsigned short kiTacho, unsigned short kdTacho, unsigned short kpSpeed, unsigned short kiSpeed, unsigned short kdSpeed, ubyte passCount, ubyte tolerance, ubyte address = MSMMUX_I2C_ADDR);
 // bool MSMMUXsetPID(tSensors link, short kpTacho, short kiTacho, short kdTacho, short kpSpeed, short kiSpeed, short kdSpeed, ubyte passCount, ubyte tolerance, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMotor(tMUXmotor muxmotor, byte power, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMMotor(tI2CTransaction &frame, tMUXmotor muxmotor, byte power, ubyte address = MSMMUX_I2C_ADDR);
+ubyte MSMMUXcommandFlags(tMUXmotor muxmotor);
+void MSMMUXbatchInit(tMSMMUXBatch &batch);
+void MSMMUXbatchMotor(tMSMMUXBatch &batch, tMUXmotor muxmotor, byte power);
+bool MSMMUXbatchCommit(tI2CTransaction &frame, tMSMMUXBatch &batch, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMotorStopBoth(tI2CTransaction &frame, tSensors link, bool brake, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMotorStop(tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMotorStop(tMUXmotor muxmotor, bool brake, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMotorStop(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMotorStop(tI2CTransaction &frame, tMUXmotor muxmotor, bool brake, ubyte address = MSMMUX_I2C_ADDR);
 void MSMMotorSetRotationTarget(tMUXmotor muxmotor, long target);
 void MSMMotorSetTimeTarget(tMUXmotor muxmotor, short target);
 void MSMMotorSetEncoderTarget(tMUXmotor muxmotor, long target);
 void MSMMotorSetEncoderTarget(tMUXmotor muxmotor, long target, bool relative);
 long MSMMotorEncoder(tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
+long MSMMotorEncoder(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMotorEncoderReset(tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
+bool MSMMotorEncoderReset(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMotorEncoderResetAll(tSensors link, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMotorBusy(tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
 bool MSMMotorStalled(tMUXmotor muxmotor, ubyte address = MSMMUX_I2C_ADDR);
@@ -163,21 +192,30 @@ void MSMMUXinit(){
  * @return true if no error occured, false if it did
  */
 bool MSMMUXreadStatus(tMUXmotor muxmotor, ubyte &motorStatus, ubyte address) {
+  tI2CTransaction frame;
+  return MSMMUXreadStatus(frame, muxmotor, motorStatus, address);
+}
 
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
-
-  MSMMUX_I2CRequest[0] = 2;               // Message size
-  MSMMUX_I2CRequest[1] = MSMMUX_I2C_ADDR; // I2C Address
-
-  switch ((byte)MPORT(muxmotor)) {
-    case 0: MSMMUX_I2CRequest[2] = MSMMUX_STATUS_MOT1; break;
-    case 1: MSMMUX_I2CRequest[2] = MSMMUX_STATUS_MOT2; break;
-  }
-
-  if (!writeI2C((tSensors)SPORT(muxmotor), MSMMUX_I2CRequest, MSMMUX_I2CReply, 1))
+/**
+ * Read the status byte of the specified motor, using a caller-owned request frame
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param motorStatus status of the motor
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMUXreadStatus(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte &motorStatus, ubyte address) {
+  frame.request[0] = 2;               // Message size
+  frame.request[1] = MSMMUX_I2C_ADDR; // I2C Address
+  frame.request[2] = (MPORT(muxmotor) == 0) ? MSMMUX_STATUS_MOT1 : MSMMUX_STATUS_MOT2;
+  frame.replyLen = 1;
+  frame.priority = I2C_PRIO_STATUS;
+
+  if (!writeI2CQueued((tSensors)SPORT(muxmotor), frame))
     return false;
 
-  motorStatus = MSMMUX_I2CReply[0];
+  motorStatus = frame.reply[0];
 
   return true;
 }
@@ -196,25 +234,44 @@ bool MSMMUXreadStatus(tMUXmotor muxmotor, ubyte &motorStatus, ubyte address) {
  * @return true if no error occured, false if it did
  */
 bool MSMMUXsendCommand(tSensors link, ubyte channel, long setpoint, byte speed, ubyte seconds, ubyte commandA, ubyte address) {
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
-
-  MSMMUX_I2CRequest[0] = 10;               // Message size
-  MSMMUX_I2CRequest[1] = address;          // I2C Address
-  MSMMUX_I2CRequest[2] = MSMMUX_MOT_OFFSET + (channel * MSMMUX_ENTRY_SIZE);
-  MSMMUX_I2CRequest[3] = (setpoint >>  0) & 0xFF;
-  MSMMUX_I2CRequest[4] = (setpoint >>  8) & 0xFF;
-  MSMMUX_I2CRequest[5] = (setpoint >> 16) & 0xFF;
-  MSMMUX_I2CRequest[6] = (setpoint >> 24) & 0xFF;
-  MSMMUX_I2CRequest[7] = (speed & 0xFF);
-  MSMMUX_I2CRequest[8] = seconds;
-  MSMMUX_I2CRequest[9] = 0;
-  MSMMUX_I2CRequest[10] = commandA;
+  tI2CTransaction frame;
+  return MSMMUXsendCommand(frame, link, channel, setpoint, speed, seconds, commandA, address);
+}
+
+/**
+ * Send a command to the MMUX, using a caller-owned request frame.
+ *
+ * Note: this is an internal function and shouldn't be used directly
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param link the MMUX port number
+ * @param channel the channel the command should apply to
+ * @param setpoint the encoder count the motor should move to
+ * @param speed the speed the motor should move at
+ * @param seconds the number of seconds the motor should run for.  Note that this takes precedence over the encoder target
+ * @param commandA the command to be sent to the motor
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMUXsendCommand(tI2CTransaction &frame, tSensors link, ubyte channel, long setpoint, byte speed, ubyte seconds, ubyte commandA, ubyte address) {
+  frame.request[0] = 10;               // Message size
+  frame.request[1] = address;          // I2C Address
+  frame.request[2] = MSMMUX_MOT_OFFSET + (channel * MSMMUX_ENTRY_SIZE);
+  frame.request[3] = (setpoint >>  0) & 0xFF;
+  frame.request[4] = (setpoint >>  8) & 0xFF;
+  frame.request[5] = (setpoint >> 16) & 0xFF;
+  frame.request[6] = (setpoint >> 24) & 0xFF;
+  frame.request[7] = (speed & 0xFF);
+  frame.request[8] = seconds;
+  frame.request[9] = 0;
+  frame.request[10] = commandA;
+  frame.replyLen = 0;
+  frame.priority = I2C_PRIO_STATUS;
 
   // make sure the targetUnit is reset for the next time
   mmuxData[link].targetUnit[channel] = MSMMUX_ROT_UNLIMITED;
 
   // send the command to the mmux
-  return writeI2C(link, MSMMUX_I2CRequest);
+  return writeI2CQueued(link, frame);
 
 }
 
@@ -228,14 +285,39 @@ bool MSMMUXsendCommand(tSensors link, ubyte channel, long setpoint, byte speed,
  * @return true if no error occured, false if it did
  */
 bool MSMMUXsendCommand(tSensors link, ubyte command, ubyte address) {
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
+  tI2CTransaction frame;
+  return MSMMUXsendCommand(frame, link, command, address);
+}
 
-  MSMMUX_I2CRequest[0] = 3;               // Message size
-  MSMMUX_I2CRequest[1] = address; // I2C Address
-  MSMMUX_I2CRequest[2] = MSMMUX_REG_CMD;
-  MSMMUX_I2CRequest[3] = command;
+/**
+ * Send a command to the MMUX, using a caller-owned request frame.
+ *
+ * Note: this is an internal function and shouldn't be used directly
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param link the MMUX port number
+ * @param command the command to be sent to the motor
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMUXsendCommand(tI2CTransaction &frame, tSensors link, ubyte command, ubyte address) {
+  frame.request[0] = 3;               // Message size
+  frame.request[1] = address; // I2C Address
+  frame.request[2] = MSMMUX_REG_CMD;
+  frame.request[3] = command;
+  frame.replyLen = 0;
+
+  // stop commands jump the queue
+  switch (command) {
+    case MSMMUX_CMD_FLOAT_MOT1:
+    case MSMMUX_CMD_FLOAT_MOT2:
+    case MSMMUX_CMD_FLOAT_BOTH:
+    case MSMMUX_CMD_BRAKE_MOT1:
+    case MSMMUX_CMD_BRAKE_MOT2:
+    case MSMMUX_CMD_BRAKE_BOTH: frame.priority = I2C_PRIO_SAFETY; break;
+    default:                    frame.priority = I2C_PRIO_STATUS; break;
+  }
 
-  return writeI2C(link, MSMMUX_I2CRequest);
+  return writeI2CQueued(link, frame);
 }
 
 /**
@@ -260,27 +342,30 @@ bool MSMMUXsendCommand(tSensors link, ubyte command, ubyte address) {
  * @return true if no error occured, false if it did
  */
 bool MSMMUXsetPID(tSensors link, unsigned short kpTacho, unsigned short kiTacho, unsigned short kdTacho, unsigned short kpSpeed, unsigned short kiSpeed, unsigned short kdSpeed, ubyte passCount, ubyte tolerance, ubyte address) {
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
-
-  MSMMUX_I2CRequest[0] = 16;               // Message size
-  MSMMUX_I2CRequest[1] = address; // I2C Address
-  MSMMUX_I2CRequest[2] = MSMMUX_KP_TACHO;
-  MSMMUX_I2CRequest[3] = kpTacho & 0xFF;
-  MSMMUX_I2CRequest[4] = (kpTacho >> 8) & 0xFF;
-  MSMMUX_I2CRequest[5] = kiTacho & 0xFF;
-  MSMMUX_I2CRequest[6] = (kiTacho >> 8) & 0xFF;
-  MSMMUX_I2CRequest[7] = kdTacho & 0xFF;
-  MSMMUX_I2CRequest[8] = (kdTacho >> 8) & 0xFF;
-  MSMMUX_I2CRequest[9] = kpSpeed & 0xFF;
-  MSMMUX_I2CRequest[10] = (kpSpeed >> 8) & 0xFF;
-  MSMMUX_I2CRequest[11] = kiSpeed & 0xFF;
-  MSMMUX_I2CRequest[12] = (kiSpeed >> 8) & 0xFF;
-  MSMMUX_I2CRequest[13] = kdSpeed & 0xFF;
-  MSMMUX_I2CRequest[14] = (kdSpeed >> 8) & 0xFF;
-  MSMMUX_I2CRequest[15] = passCount;
-  MSMMUX_I2CRequest[16] = tolerance;
-
-  return writeI2C(link, MSMMUX_I2CRequest);
+  tI2CTransaction transaction;
+
+  transaction.request[0] = 16;               // Message size
+  transaction.request[1] = address; // I2C Address
+  transaction.request[2] = MSMMUX_KP_TACHO;
+  transaction.request[3] = kpTacho & 0xFF;
+  transaction.request[4] = (kpTacho >> 8) & 0xFF;
+  transaction.request[5] = kiTacho & 0xFF;
+  transaction.request[6] = (kiTacho >> 8) & 0xFF;
+  transaction.request[7] = kdTacho & 0xFF;
+  transaction.request[8] = (kdTacho >> 8) & 0xFF;
+  transaction.request[9] = kpSpeed & 0xFF;
+  transaction.request[10] = (kpSpeed >> 8) & 0xFF;
+  transaction.request[11] = kiSpeed & 0xFF;
+  transaction.request[12] = (kiSpeed >> 8) & 0xFF;
+  transaction.request[13] = kdSpeed & 0xFF;
+  transaction.request[14] = (kdSpeed >> 8) & 0xFF;
+  transaction.request[15] = passCount;
+  transaction.request[16] = tolerance;
+
+  transaction.replyLen = 0;
+  transaction.priority = I2C_PRIO_STATUS;
+
+  return writeI2CQueued(link, transaction);
 }
 
 /**
@@ -292,6 +377,39 @@ bool MSMMUXsetPID(tSensors link, unsigned short kpTacho, unsigned short kiTacho,
  * @return true if no error occured, false if it did
  */
 bool MSMMotor(tMUXmotor muxmotor, byte power, ubyte address) {
+  tI2CTransaction frame;
+  return MSMMotor(frame, muxmotor, power, address);
+}
+
+/**
+ * Run motor with specified speed, using a caller-owned request frame.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param power power the amount of power to apply to the motor, value between -100 and +100
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMotor(tI2CTransaction &frame, tMUXmotor muxmotor, byte power, ubyte address) {
+  ubyte commandA = MSMMUXcommandFlags(muxmotor) + MSMMUX_CMD_GO;
+
+  switch (mmuxData[SPORT(muxmotor)].targetUnit[MPORT(muxmotor)]) {
+    case MSMMUX_ROT_UNLIMITED: return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), 0, power, 0, commandA, address);
+    case MSMMUX_ROT_DEGREES:   return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)], power, 0, commandA, address);
+    case MSMMUX_ROT_SECONDS:   return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), 0, power, mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)], commandA, address);
+  }
+  return true;
+}
+
+/**
+ * Work out the command A flags for a motor from its configured settings.
+ * MSMMUX_CMD_GO is not included.
+ *
+ * Note: this is an internal function and shouldn't be used directly
+ * @param muxmotor the motor-MUX motor
+ * @return the command A flags
+ */
+ubyte MSMMUXcommandFlags(tMUXmotor muxmotor) {
   ubyte commandA = 0;
   commandA += (mmuxData[SPORT(muxmotor)].pidcontrol[MPORT(muxmotor)]) ? MSMMUX_CMD_SPEED : 0;
   commandA += (mmuxData[SPORT(muxmotor)].ramping[MPORT(muxmotor)] != MSMMUX_RAMP_NONE) ? MSMMUX_CMD_RAMP : 0;
@@ -299,14 +417,94 @@ bool MSMMotor(tMUXmotor muxmotor, byte power, ubyte address) {
   commandA += (mmuxData[SPORT(muxmotor)].targetUnit[MPORT(muxmotor)] == MSMMUX_ROT_DEGREES) ? MSMMUX_CMD_TACHO : 0;
   commandA += (mmuxData[SPORT(muxmotor)].targetUnit[MPORT(muxmotor)] == MSMMUX_ROT_SECONDS) ? MSMMUX_CMD_TIME : 0;
   commandA += (mmuxData[SPORT(muxmotor)].relTarget[MPORT(muxmotor)]) ? MSMMUX_CMD_RELATIVE : 0;
-  commandA += MSMMUX_CMD_GO;
+  return commandA;
+}
+
+/**
+ * Clear a batch so channels can be staged into it
+ *
+ * @param batch the batch to clear
+ */
+void MSMMUXbatchInit(tMSMMUXBatch &batch) {
+  memset(batch.staged[0], 0, 4);
+}
 
+/**
+ * Stage a motor in a batch.  The settings made with MSMMotorSetRotationTarget,
+ * MSMMotorSetEncoderTarget, MSMMotorSetTimeTarget etc. are captured now, the motor
+ * only starts when the batch is committed with MSMMUXbatchCommit().  Channels the
+ * MUX does not have (MPORT 2 and 3) are ignored, like MSMotorStop() does.
+ *
+ * @param batch the batch to stage the motor in
+ * @param muxmotor the motor-MUX motor
+ * @param power power the amount of power to apply to the motor, value between -100 and +100
+ */
+void MSMMUXbatchMotor(tMSMMUXBatch &batch, tMUXmotor muxmotor, byte power) {
+  if (MPORT(muxmotor) >= 2)
+    return;
+
+  short i = SPORT(muxmotor) * 2 + MPORT(muxmotor);
+
+  batch.setpoint[i] = 0;
+  batch.seconds[i] = 0;
   switch (mmuxData[SPORT(muxmotor)].targetUnit[MPORT(muxmotor)]) {
-    case MSMMUX_ROT_UNLIMITED: return MSMMUXsendCommand((tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), 0, power, 0, commandA, address);
-    case MSMMUX_ROT_DEGREES:   return MSMMUXsendCommand((tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)], power, 0, commandA, address);
-    case MSMMUX_ROT_SECONDS:   return MSMMUXsendCommand((tSensors)SPORT(muxmotor), (ubyte)MPORT(muxmotor), 0, power, mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)], commandA, address);
+    case MSMMUX_ROT_DEGREES: batch.setpoint[i] = mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)]; break;
+    case MSMMUX_ROT_SECONDS: batch.seconds[i] = mmuxData[SPORT(muxmotor)].target[MPORT(muxmotor)]; break;
   }
-  return true;
+  batch.speed[i] = power;
+  batch.commandA[i] = MSMMUXcommandFlags(muxmotor);
+  batch.staged[SPORT(muxmotor)] |= (1 << MPORT(muxmotor));
+}
+
+/**
+ * Start all the motors staged in a batch.  A MUX with a single staged channel gets
+ * one register write with MSMMUX_CMD_GO.  When both channels are staged, the register
+ * blocks are loaded without GO and MSMMUX_CMD_START_BOTH fires them together, so
+ * the two motors start without any skew between them.  The batch is cleared afterwards.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param batch the batch to commit
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMUXbatchCommit(tI2CTransaction &frame, tMSMMUXBatch &batch, ubyte address) {
+  bool success = true;
+  ubyte go = 0;
+  short i = 0;
+
+  for (short link = 0; link < 4; link++) {
+    if (batch.staged[link] == 0)
+      continue;
+
+    // a lone channel starts straight away, a pair waits for START_BOTH
+    go = (batch.staged[link] == 3) ? 0 : MSMMUX_CMD_GO;
+    for (short channel = 0; channel < 2; channel++) {
+      if ((batch.staged[link] & (1 << channel)) == 0)
+        continue;
+      i = link * 2 + channel;
+      if (!MSMMUXsendCommand(frame, (tSensors)link, channel, batch.setpoint[i], batch.speed[i], batch.seconds[i], batch.commandA[i] + go, address))
+        success = false;
+    }
+
+    if (go == 0 && !MSMMUXsendCommand(frame, (tSensors)link, MSMMUX_CMD_START_BOTH, address))
+      success = false;
+  }
+
+  MSMMUXbatchInit(batch);
+  return success;
+}
+
+/**
+ * Stop both motors on a MUX with a single command
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param link the MMUX port number
+ * @param brake when set to true: use brake, false: use float
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMotorStopBoth(tI2CTransaction &frame, tSensors link, bool brake, ubyte address) {
+  return MSMMUXsendCommand(frame, link, brake ? MSMMUX_CMD_BRAKE_BOTH : MSMMUX_CMD_FLOAT_BOTH, address);
 }
 
 /**
@@ -318,10 +516,24 @@ bool MSMMotor(tMUXmotor muxmotor, byte power, ubyte address) {
  * @return true if no error occured, false if it did
  */
 bool MSMotorStop(tMUXmotor muxmotor, ubyte address) {
+  tI2CTransaction frame;
+  return MSMotorStop(frame, muxmotor, address);
+}
+
+/**
+ * Stop the motor, using a caller-owned request frame. Uses the brake method specified
+ * with MSMMotorSetBrake or MSMMotorSetFloat.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMotorStop(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address) {
   if (MPORT(muxmotor) == 0)
-    return MSMotorStop(muxmotor, mmuxData[SPORT(muxmotor)].brake[MPORT(muxmotor)], address);
+    return MSMotorStop(frame, muxmotor, mmuxData[SPORT(muxmotor)].brake[MPORT(muxmotor)], address);
   else if (MPORT(muxmotor) == 1)
-    return MSMotorStop(muxmotor, mmuxData[SPORT(muxmotor)].brake[MPORT(muxmotor)], address);
+    return MSMotorStop(frame, muxmotor, mmuxData[SPORT(muxmotor)].brake[MPORT(muxmotor)], address);
   return true;
 }
 
@@ -334,10 +546,25 @@ bool MSMotorStop(tMUXmotor muxmotor, ubyte address) {
  * @return true if no error occured, false if it did
  */
 bool MSMotorStop(tMUXmotor muxmotor, bool brake, ubyte address) {
+  tI2CTransaction frame;
+  return MSMotorStop(frame, muxmotor, brake, address);
+}
+
+/**
+ * Stop the motor, using a caller-owned request frame. This function overrides the
+ * preconfigured braking method.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param brake when set to true: use brake, false: use float
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMotorStop(tI2CTransaction &frame, tMUXmotor muxmotor, bool brake, ubyte address) {
   if (MPORT(muxmotor) == 0)
-    return MSMMUXsendCommand((tSensors)SPORT(muxmotor), brake ? MSMMUX_CMD_BRAKE_MOT1 : MSMMUX_CMD_FLOAT_MOT1, address);
+    return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), brake ? MSMMUX_CMD_BRAKE_MOT1 : MSMMUX_CMD_FLOAT_MOT1, address);
   else if (MPORT(muxmotor) == 1)
-    return MSMMUXsendCommand((tSensors)SPORT(muxmotor), brake ? MSMMUX_CMD_BRAKE_MOT2 : MSMMUX_CMD_FLOAT_MOT2, address);
+    return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), brake ? MSMMUX_CMD_BRAKE_MOT2 : MSMMUX_CMD_FLOAT_MOT2, address);
   return true;
 }
 
@@ -401,24 +628,30 @@ void MSMMotorSetEncoderTarget(tMUXmotor muxmotor, long target, bool relative) {
  * @return the current value of the encoder
  */
 long MSMMotorEncoder(tMUXmotor muxmotor, ubyte address) {
-  long result;
-
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
-
-  MSMMUX_I2CRequest[0] = 2;               // Message size
-  MSMMUX_I2CRequest[1] = address; // I2C Address
-
-  switch ((byte)MPORT(muxmotor)) {
-    case 0: MSMMUX_I2CRequest[2] = MSMMUX_TACHO_MOT1; break;
-    case 1: MSMMUX_I2CRequest[2] = MSMMUX_TACHO_MOT2; break;
-  }
+  tI2CTransaction frame;
+  return MSMMotorEncoder(frame, muxmotor, address);
+}
 
-  if (!writeI2C((tSensors)SPORT(muxmotor), MSMMUX_I2CRequest,  MSMMUX_I2CReply, 4))
+/**
+ * Fetch the current encoder value for specified motor channel, using a caller-owned
+ * request frame.  Polling loops can keep reusing the same frame.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param address I2C address of the sensor (optional)
+ * @return the current value of the encoder
+ */
+long MSMMotorEncoder(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address) {
+  frame.request[0] = 2;               // Message size
+  frame.request[1] = address; // I2C Address
+  frame.request[2] = (MPORT(muxmotor) == 0) ? MSMMUX_TACHO_MOT1 : MSMMUX_TACHO_MOT2;
+  frame.replyLen = 4;
+  frame.priority = I2C_PRIO_ENCODER;
+
+  if (!writeI2CQueued((tSensors)SPORT(muxmotor), frame))
     return 0;
 
-  result = MSMMUX_I2CReply[0] + (MSMMUX_I2CReply[1]<<8) + (MSMMUX_I2CReply[2]<<16) + (MSMMUX_I2CReply[3]<<24);
-
-  return result;
+  return frame.reply[0] + (frame.reply[1]<<8) + (frame.reply[2]<<16) + (frame.reply[3]<<24);
 }
 
 /**
@@ -433,9 +666,22 @@ long MSMMotorEncoder(tMUXmotor muxmotor, ubyte address) {
  */
 
 bool MSMMotorEncoderReset(tMUXmotor muxmotor, ubyte address) {
+  tI2CTransaction frame;
+  return MSMMotorEncoderReset(frame, muxmotor, address);
+}
+
+/**
+ * Reset target encoder for specified motor channel, using a caller-owned request frame.
+ *
+ * @param frame the request frame to use, no other task may use it at the same time
+ * @param muxmotor the motor-MUX motor
+ * @param address I2C address of the sensor (optional)
+ * @return true if no error occured, false if it did
+ */
+bool MSMMotorEncoderReset(tI2CTransaction &frame, tMUXmotor muxmotor, ubyte address) {
   switch((byte)MPORT(muxmotor)) {
-    case 0: return MSMMUXsendCommand((tSensors)SPORT(muxmotor), MSMMUX_CMD_RESET_MOT1, address); break;
-    case 1: return MSMMUXsendCommand((tSensors)SPORT(muxmotor), MSMMUX_CMD_RESET_MOT2, address); break;
+    case 0: return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), MSMMUX_CMD_RESET_MOT1, address); break;
+    case 1: return MSMMUXsendCommand(frame, (tSensors)SPORT(muxmotor), MSMMUX_CMD_RESET_MOT2, address); break;
   }
   return false;
 }
@@ -464,18 +710,19 @@ bool MSMMotorEncoderResetAll(tSensors link, ubyte address) {
 bool MSMMotorBusy(tMUXmotor muxmotor, ubyte address) {
   ubyte status = 0;
   ubyte commandA = 0;
+  tI2CTransaction transaction;
 
   // Fetch the last sent commandA
-  memset(MSMMUX_I2CRequest, 0, sizeof(tByteArray));
-
-  MSMMUX_I2CRequest[0] = 2;               // Message size
-  MSMMUX_I2CRequest[1] = address; // I2C Address
-  MSMMUX_I2CRequest[2] = MSMMUX_MOT_OFFSET + (MPORT(muxmotor) * MSMMUX_ENTRY_SIZE) + MSMMUX_CMD_A;
+  transaction.request[0] = 2;               // Message size
+  transaction.request[1] = address; // I2C Address
+  transaction.request[2] = MSMMUX_MOT_OFFSET + (MPORT(muxmotor) * MSMMUX_ENTRY_SIZE) + MSMMUX_CMD_A;
+  transaction.replyLen = 1;
+  transaction.priority = I2C_PRIO_STATUS;
 
-  if (!writeI2C((tSensors)SPORT(muxmotor), MSMMUX_I2CRequest, MSMMUX_I2CReply, 1))
+  if (!writeI2CQueued((tSensors)SPORT(muxmotor), transaction))
     return false;
 
-  commandA = MSMMUX_I2CReply[0];
+  commandA = transaction.reply[0];
 
   // If commandA is 0 then the motor can't be busy.
   if (commandA == 0)
@@ -534,7 +781,7 @@ void MSMMotorSetFloat(tMUXmotor muxmotor) {
  * @param constspeed use speed control to ensure motor speed stays constant under varying load
  */
 void MSMMotorSetSpeedCtrl(tMUXmotor muxmotor, bool constspeed) {
-  mmuxData[SPORT(muxmotor)].pidcontrol[MPORT(muxmotor)] = true;
+  mmuxData[SPORT(muxmotor)].pidcontrol[MPORT(muxmotor)] = constspeed;
 }
 
 /**